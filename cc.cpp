@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+// errorck-cc wraps a compiler so a build can feed errorck without a
+// compile_commands.json: run the build with CC="errorck-cc cc" (or any other
+// compiler) and ERRORCK_SPOOL_DIR set, and every compile writes its exact
+// command line into the spool directory before running the compiler.
+// errorck --spool-dir reads the entries, with --spool-follow while the build
+// is still running.
+//
+// Each compiled source gets its own entry in compile_commands.json format. The
+// entry is written under a hidden temporary name and renamed into place, so
+// errorck never reads one that is only partly written. Spooling never fails
+// the build; a problem is reported and the compiler runs anyway.
+
+static void PrintUsage(const char *argv0) {
+  std::cerr << "Usage: " << argv0 << " <compiler> [<argument>...]\n";
+}
+
+// Options whose value is the next argument, which must not be mistaken for a
+// source file.
+static bool TakesSeparateValue(const std::string &arg) {
+  static const char *const kOptions[] = {
+      "-o",          "-I",        "-D",          "-U",
+      "-L",          "-l",        "-B",          "-T",
+      "-F",          "-x",        "-MF",         "-MT",
+      "-MQ",         "-include",  "-imacros",    "-include-pch",
+      "-isystem",    "-iquote",   "-idirafter",  "-isysroot",
+      "-iprefix",    "--sysroot", "-target",     "-arch",
+      "-Xclang",     "-Xlinker",  "-Xassembler", "-Xpreprocessor",
+      "--param",     "-aux-info"};
+  for (const char *option : kOptions) {
+    if (arg == option) {
+      return true;
+    }
+  }
+  // -Xarch_<arch> passes the next argument through for one architecture.
+  return arg.rfind("-Xarch_", 0) == 0;
+}
+
+static bool IsSource(const std::string &arg) {
+  static const char *const kExtensions[] = {".c",   ".cc",  ".cpp", ".cxx",
+                                            ".c++", ".C",   ".m",   ".mm",
+                                            ".i",   ".ii"};
+  std::string extension = std::filesystem::path(arg).extension().string();
+  for (const char *candidate : kExtensions) {
+    if (extension == candidate) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static std::string JsonString(const std::string &value) {
+  std::string out = "\"";
+  for (char c : value) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        char escaped[8];
+        std::snprintf(escaped, sizeof(escaped), "\\u%04x",
+                      static_cast<unsigned>(c));
+        out += escaped;
+      } else {
+        out += c;
+      }
+    }
+  }
+  return out + "\"";
+}
+
+#ifdef _WIN32
+static int CurrentProcessId() { return _getpid(); }
+#else
+static int CurrentProcessId() { return static_cast<int>(getpid()); }
+#endif
+
+// Writes one entry per source in `args` (args[0] is the compiler). Compiles
+// that only preprocess or only list dependencies are not spooled.
+static bool Spool(const std::string &dir, const std::vector<std::string> &args,
+                  std::string &error) {
+  std::vector<size_t> sources;
+  for (size_t i = 1; i < args.size(); ++i) {
+    const std::string &arg = args[i];
+    if (arg == "-E" || arg == "-M" || arg == "-MM") {
+      return true;
+    }
+    if (TakesSeparateValue(arg)) {
+      ++i;
+    } else if (IsSource(arg) && arg[0] != '-') {
+      sources.push_back(i);
+    }
+  }
+  if (sources.empty()) {
+    return true;
+  }
+
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  if (ec) {
+    error = "failed to create " + dir + ": " + ec.message();
+    return false;
+  }
+  std::filesystem::path directory = std::filesystem::current_path(ec);
+  if (ec) {
+    error = "failed to read the working directory: " + ec.message();
+    return false;
+  }
+
+  // Names sort in the order compiles started, which errorck analyzes in.
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  char stamp[32];
+  std::snprintf(stamp, sizeof(stamp), "%020lld",
+                static_cast<long long>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(now)
+                        .count()));
+  std::string prefix =
+      std::string(stamp) + "-" + std::to_string(CurrentProcessId());
+
+  for (size_t n = 0; n < sources.size(); ++n) {
+    std::filesystem::path file = directory / args[sources[n]];
+    std::string entry = "{\"directory\": " + JsonString(directory.string()) +
+                        ", \"file\": " +
+                        JsonString(file.lexically_normal().string()) +
+                        ", \"arguments\": [";
+    bool first = true;
+    for (size_t i = 0; i < args.size(); ++i) {
+      // Each entry names only its own source, like CMake's database does.
+      if (i != sources[n] &&
+          std::find(sources.begin(), sources.end(), i) != sources.end()) {
+        continue;
+      }
+      entry += (first ? "" : ", ") + JsonString(args[i]);
+      first = false;
+    }
+    entry += "]}\n";
+
+    std::string name = prefix + "-" + std::to_string(n) + ".json";
+    std::filesystem::path temporary =
+        std::filesystem::path(dir) / ("." + name + ".tmp");
+    {
+      std::ofstream out(temporary, std::ios::binary);
+      out << entry;
+      if (!out.flush()) {
+        error = "failed to write " + temporary.string();
+        return false;
+      }
+    }
+    std::filesystem::rename(temporary, std::filesystem::path(dir) / name, ec);
+    if (ec) {
+      error = "failed to rename " + temporary.string() + ": " + ec.message();
+      std::filesystem::remove(temporary, ec);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::vector<std::string> args(argv + 1, argv + argc);
+
+  const char *spool_dir = std::getenv("ERRORCK_SPOOL_DIR");
+  if (spool_dir && *spool_dir) {
+    std::string error;
+    if (!Spool(spool_dir, args, error)) {
+      std::cerr << "errorck-cc: warning: " << error << "\n";
+    }
+  }
+
+  std::vector<char *> exec_args;
+  for (int i = 1; i < argc; ++i) {
+    exec_args.push_back(argv[i]);
+  }
+  exec_args.push_back(nullptr);
+#ifdef _WIN32
+  intptr_t rc = _spawnvp(_P_WAIT, exec_args[0], exec_args.data());
+  if (rc != -1) {
+    return static_cast<int>(rc);
+  }
+#else
+  execvp(exec_args[0], exec_args.data());
+#endif
+  std::cerr << "errorck-cc: failed to run " << args[0] << ": "
+            << std::strerror(errno) << "\n";
+  return 127;
+}
@@ -1,42 +1,86 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "schema.h"
 #include "sqlite3.h"
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/ASTTypeTraits.h"
 #include "clang/AST/Decl.h"
 #include "clang/AST/Expr.h"
-#include "clang/AST/ParentMapContext.h"
+#include "clang/AST/ParentMap.h"
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/AST/Stmt.h"
+#include "clang/Analysis/CFG.h"
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Basic/FileManager.h"
 #include "clang/Basic/SourceManager.h"
+#include "clang/Basic/Version.h"
 #include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/FrontendPluginRegistry.h"
+#include "clang/Lex/HeaderSearchOptions.h"
+#include "clang/Lex/Preprocessor.h"
 #include "clang/Tooling/ArgumentsAdjusters.h"
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/STLFunctionExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Support/Casting.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/JSON.h"
-
-#ifndef CLANG_RESOURCE_DIR
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/xxhash.h"
+
+// ERRORCK_PLUGIN builds the clang plugin instead of the errorck tool. The
+// plugin lives inside the compiler, so it leaves out the command line
+// options, which would collide with clang's own, and everything that needs
+// libTooling.
+#if !defined(CLANG_RESOURCE_DIR) && !defined(ERRORCK_PLUGIN)
 #error "CLANG_RESOURCE_DIR must be defined by the build system."
 #endif
 
 using namespace clang::tooling;
 using namespace llvm;
 
+#ifndef ERRORCK_PLUGIN
 static cl::OptionCategory Category("errorck options");
 
 static cl::opt<std::string>
@@ -73,6 +117,161 @@ static cl::opt<std::string>
                      cl::desc("Path to compile_flags.txt with extra arguments"),
                      cl::value_desc("path"), cl::cat(Category));
 
+static cl::list<std::string> ExtraProfiles(
+    "profile",
+    cl::desc("Additional selection profile evaluated in the same pass, as "
+             "mode=<mode>,db=<path>[,functions=<path>][,aggregate=true]"
+             "[,aggregate-examples=<n>]"),
+    cl::value_desc("spec"), cl::cat(Category));
+
+static cl::opt<bool>
+    Aggregate("aggregate",
+              cl::desc("Write per-function, per-handling-type counts of "
+                       "unique call sites instead of one row per call site"),
+              cl::init(false), cl::cat(Category));
+
+static cl::opt<unsigned> AggregateExamples(
+    "aggregate-examples",
+    cl::desc("With --aggregate, also keep the first <n> call sites of each "
+             "count as examples"),
+    cl::value_desc("n"), cl::init(0), cl::cat(Category));
+
+static cl::list<std::string> IncludePaths(
+    "include-path",
+    cl::desc("Only analyze declarations in files whose absolute path matches "
+             "this regular expression (may be repeated)"),
+    cl::value_desc("regex"), cl::cat(Category));
+
+static cl::list<std::string> ExcludePaths(
+    "exclude-path",
+    cl::desc("Skip declarations in files whose absolute path matches this "
+             "regular expression (may be repeated)"),
+    cl::value_desc("regex"), cl::cat(Category));
+
+static cl::opt<bool>
+    SkipSystemHeaders("skip-system-headers",
+                      cl::desc("Skip declarations in system headers"),
+                      cl::init(false), cl::cat(Category));
+
+static cl::opt<bool> DedupHeaderFunctions(
+    "dedup-header-functions",
+    cl::desc("Analyze each function defined in a header once per run instead "
+             "of once per translation unit that includes it"),
+    cl::init(false), cl::cat(Category));
+
+static cl::opt<unsigned>
+    ShardIndex("shard-index",
+               cl::desc("Analyze only the translation units of this shard "
+                        "(0-based, see --shard-count)"),
+               cl::value_desc("i"), cl::init(0), cl::cat(Category));
+
+static cl::opt<unsigned> ShardCount(
+    "shard-count",
+    cl::desc("Split the translation units into this many shards and analyze "
+             "only the one selected by --shard-index"),
+    cl::value_desc("n"), cl::init(1), cl::cat(Category));
+
+static cl::opt<bool> ShardBySize(
+    "shard-by-size",
+    cl::desc("Balance shards by source file size instead of path hash"),
+    cl::init(false), cl::cat(Category));
+
+static cl::opt<bool> Isolate(
+    "isolate",
+    cl::desc("Analyze each translation unit in a separate worker process, so "
+             "a crash, hang, or runaway allocation only skips that "
+             "translation unit"),
+    cl::init(false), cl::cat(Category));
+
+static cl::opt<unsigned>
+    TuTimeout("tu-timeout",
+              cl::desc("With --isolate, kill a worker that runs longer than "
+                       "this many seconds (0 for no limit)"),
+              cl::value_desc("seconds"), cl::init(0), cl::cat(Category));
+
+static cl::opt<unsigned> TuMemoryLimit(
+    "tu-memory-limit",
+    cl::desc("With --isolate, limit each worker's memory to this many "
+             "megabytes (0 for no limit)"),
+    cl::value_desc("MB"), cl::init(0), cl::cat(Category));
+
+// Set by --isolate on the worker processes it starts.
+static cl::opt<std::string> WorkerOutput("worker-output", cl::Hidden,
+                                         cl::cat(Category));
+static cl::opt<std::string> WorkerSource("worker-source", cl::Hidden,
+                                         cl::cat(Category));
+static cl::opt<bool> WorkerRecordInputs("worker-record-inputs", cl::Hidden,
+                                        cl::init(false), cl::cat(Category));
+
+static cl::opt<bool> SqliteBulkLoad(
+    "sqlite-bulk-load",
+    cl::desc("Trade database durability for insert speed (in-memory journal, "
+             "no fsync, larger page cache)"),
+    cl::init(false), cl::cat(Category));
+
+static cl::opt<std::string> SpoolDir(
+    "spool-dir",
+    cl::desc("Analyze the compile commands errorck-cc spooled into this "
+             "directory instead of listed sources"),
+    cl::value_desc("path"), cl::cat(Category));
+
+static cl::opt<bool> SpoolFollow(
+    "spool-follow",
+    cl::desc("With --spool-dir, keep analyzing newly spooled commands until "
+             "a file named \"done\" appears in the directory"),
+    cl::init(false), cl::cat(Category));
+
+static cl::list<std::string> AstFiles(
+    "ast-file",
+    cl::desc("Analyze a serialized AST written by clang -emit-ast instead of "
+             "parsing sources; may be repeated"),
+    cl::value_desc("path"), cl::cat(Category));
+
+static cl::opt<std::string> PchCachePath(
+    "pch-cache",
+    cl::desc("Directory of precompiled headers for the #include lines "
+             "translation units start with, shared across translation units "
+             "and runs"),
+    cl::value_desc("path"), cl::cat(Category));
+
+static cl::opt<std::string> CachePath(
+    "cache",
+    cl::desc("Path to a persistent cache of per-translation-unit results; "
+             "unchanged translation units are replayed instead of parsed"),
+    cl::value_desc("path"), cl::cat(Category));
+
+static cl::opt<unsigned>
+    Jobs("jobs",
+         cl::desc("Number of translation units to analyze in parallel "
+                  "(0 uses every hardware thread)"),
+         cl::value_desc("n"), cl::init(1), cl::cat(Category));
+
+static cl::opt<unsigned> IntraTuJobs(
+    "intra-tu-jobs",
+    cl::desc("Number of threads that analyze the top-level declarations of "
+             "each translation unit once it is parsed"),
+    cl::value_desc("n"), cl::init(1), cl::cat(Category));
+
+static cl::opt<bool> Pipeline(
+    "pipeline",
+    cl::desc("Parse the next translation unit on a separate thread while the "
+             "current one is analyzed"),
+    cl::init(false), cl::cat(Category));
+
+static cl::opt<bool> Prefilter(
+    "prefilter",
+    cl::desc("Preprocess each translation unit first and skip the full parse "
+             "when no notable function is named in it"),
+    cl::init(false), cl::cat(Category));
+
+static cl::opt<unsigned> MemoryBudget(
+    "memory-budget",
+    cl::desc("Only start a translation unit while the estimated peak memory "
+             "of those in flight fits in this many megabytes; also picks "
+             "--jobs when it is not given (0 for no budget)"),
+    cl::value_desc("MB"), cl::init(0), cl::cat(Category));
+#endif // ERRORCK_PLUGIN
+
 enum class ErrorReportingType {
   kReturnValue,
   kErrno,
@@ -86,6 +285,40 @@ struct AnalysisConfig {
   bool list_non_void_calls = false;
 };
 
+// One selection of calls together with its functions file and output
+// database. The top-level flags describe the first profile; --profile adds
+// more, and every profile is evaluated during the same traversal.
+struct AnalysisProfile {
+  AnalysisConfig config;
+  NotableFunctions notable_functions;
+  std::unordered_set<std::string> handler_functions;
+  std::unordered_set<std::string> logger_functions;
+  std::string db_path;
+  // Write counts instead of rows (--aggregate), keeping up to
+  // `aggregate_examples` call sites per count.
+  bool aggregate = false;
+  unsigned aggregate_examples = 0;
+  // Index of the first profile with identical handler and logger sets.
+  // Classification only depends on those sets, so profiles in the same group
+  // share one classification per call.
+  size_t handler_group = 0;
+};
+
+// Which files have their declarations analyzed at all. Unlike profiles this
+// applies to the whole run: files outside the scope are never traversed.
+struct AnalysisScope {
+  std::vector<std::string> include_patterns;
+  std::vector<std::string> exclude_patterns;
+  std::vector<llvm::Regex> include_paths;
+  std::vector<llvm::Regex> exclude_paths;
+  bool skip_system_headers = false;
+
+  bool IsUnrestricted() const {
+    return include_paths.empty() && exclude_paths.empty() &&
+           !skip_system_headers;
+  }
+};
+
 static constexpr const char kDynamicCalleeName[] = "<dynamic function call>";
 
 struct AssignedLocation {
@@ -113,6 +346,81 @@ struct HandlingResult {
   std::optional<AssignedLocation> assigned;
 };
 
+// A single output row for the profile at index `profile`. Rows are collected
+// per translation unit and handed to the writers in source order, so analysis
+// never touches a database directly.
+struct CallRecord {
+  size_t profile = 0;
+  std::string name;
+  std::string filename;
+  unsigned line = 0;
+  unsigned column = 0;
+  HandlingType handling_type = HandlingType::kNone;
+  std::optional<AssignedLocation> assigned;
+  // Index into TranslationUnitOutput::shared_functions of the header function
+  // the call was found in, or -1 when the call is not in one.
+  int shared_function = -1;
+};
+
+// A function definition in a header, identified by the hash of the header's
+// contents and the definition's offset within it, so every translation unit
+// that includes the header agrees on it.
+using SharedFunctionKey = std::pair<uint64_t, unsigned>;
+
+class SharedFunctionRegistry;
+
+// A file the frontend entered while parsing a translation unit, with a hash of
+// the contents it saw.
+struct InputFile {
+  std::string path;
+  uint64_t hash = 0;
+};
+
+// Everything a single translation unit run produces. `inputs` is only filled
+// in when `record_inputs` is set, which --cache needs to validate entries.
+//
+// With --dedup-header-functions, `shared_registry` is set and `index` is the
+// translation unit's position in the run. `shared_functions` then lists the
+// header functions it claimed, and `skipped_shared_functions` records whether
+// any were left to an earlier translation unit, which makes `rows` incomplete.
+//
+// `peak_memory_kb` is the worker's peak resident size in KiB under --isolate,
+// and otherwise an unmeasured estimate of what the translation unit added to
+// the resident size, scaled from its AST and source buffers.
+// `parse_ms` runs from the start of the frontend to the finished AST, and
+// `analysis_ms` covers the traversal.
+struct TranslationUnitOutput {
+  std::vector<CallRecord> rows;
+  bool record_inputs = false;
+  std::vector<InputFile> inputs;
+  SharedFunctionRegistry *shared_registry = nullptr;
+  size_t index = 0;
+  std::vector<SharedFunctionKey> shared_functions;
+  bool skipped_shared_functions = false;
+  uint64_t peak_memory_kb = 0;
+  uint64_t parse_ms = 0;
+  uint64_t analysis_ms = 0;
+  // Threads AnalyzeTranslationUnit may use (--intra-tu-jobs).
+  unsigned intra_tu_jobs = 1;
+};
+
+// What a translation unit cost to analyze, stored in the primary output
+// database so the next run can schedule with it. Entries only apply while
+// `command_hash` still matches the translation unit's compile commands.
+struct TranslationUnitStats {
+  uint64_t command_hash = 0;
+  uint64_t peak_memory_kb = 0;
+  uint64_t parse_ms = 0;
+  uint64_t analysis_ms = 0;
+};
+
+static uint64_t MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+}
+
 static bool ParseErrorReportingType(llvm::StringRef value,
                                     ErrorReportingType &out) {
   if (value == "return_value") {
@@ -126,6 +434,7 @@ static bool ParseErrorReportingType(llvm::StringRef value,
   return false;
 }
 
+#ifndef ERRORCK_PLUGIN
 static std::string TrimWhitespace(std::string text) {
   const char *spaces = " \t\r\n";
   size_t start = text.find_first_not_of(spaces);
@@ -157,6 +466,7 @@ static bool ReadCompileFlagsFile(const std::string &path,
   }
   return true;
 }
+#endif // ERRORCK_PLUGIN
 
 static const char *HandlingTypeName(HandlingType type) {
   switch (type) {
@@ -283,6 +593,127 @@ static bool LoadNotableFunctions(const std::string &path, NotableFunctions &out,
   return true;
 }
 
+#ifndef ERRORCK_PLUGIN
+// Parses a --profile value of the form
+// "mode=<mode>,db=<path>[,functions=<path>][,aggregate=true|false]
+// [,aggregate-examples=<n>]", where <mode> is one of notable-functions,
+// all-non-void, exclude-notable-functions or list-non-void-calls, and loads
+// the profile's functions file. aggregate=true writes counts in place of rows
+// like --aggregate, and aggregate-examples=<n>, which requires it, keeps the
+// first <n> call sites of each count like --aggregate-examples.
+static bool ParseProfileSpec(llvm::StringRef spec, AnalysisProfile &out,
+                             std::string &error) {
+  std::string mode;
+  std::string functions_path;
+  llvm::SmallVector<llvm::StringRef, 4> fields;
+  spec.split(fields, ',', -1, false);
+  for (llvm::StringRef field : fields) {
+    auto [key, value] = field.split('=');
+    if (value.empty()) {
+      error = "Invalid --profile field \"" + field.str() +
+              "\" (expected key=value).";
+      return false;
+    }
+    if (key == "mode") {
+      mode = value.str();
+    } else if (key == "db") {
+      out.db_path = value.str();
+    } else if (key == "functions") {
+      functions_path = value.str();
+    } else if (key == "aggregate") {
+      if (value == "true") {
+        out.aggregate = true;
+      } else if (value != "false") {
+        error = "--profile aggregate must be true or false.";
+        return false;
+      }
+    } else if (key == "aggregate-examples") {
+      if (value.getAsInteger(10, out.aggregate_examples)) {
+        error = "--profile aggregate-examples must be a number.";
+        return false;
+      }
+    } else {
+      error = "Unknown --profile key \"" + key.str() + "\".";
+      return false;
+    }
+  }
+
+  if (out.db_path.empty()) {
+    error = "--profile " + spec.str() + " is missing db=<path>.";
+    return false;
+  }
+  if (out.aggregate_examples && !out.aggregate) {
+    error = "--profile aggregate-examples requires aggregate=true.";
+    return false;
+  }
+
+  if (mode == "notable-functions") {
+    if (functions_path.empty()) {
+      error = "--profile mode=notable-functions requires functions=<path>.";
+      return false;
+    }
+  } else if (mode == "all-non-void") {
+    out.config.analyze_all_non_void = true;
+  } else if (mode == "exclude-notable-functions") {
+    if (functions_path.empty()) {
+      error = "--profile mode=exclude-notable-functions requires "
+              "functions=<path>.";
+      return false;
+    }
+    out.config.analyze_all_non_void = true;
+    out.config.exclude_notable = true;
+  } else if (mode == "list-non-void-calls") {
+    if (!functions_path.empty()) {
+      error = "--profile mode=list-non-void-calls cannot be combined with "
+              "functions=<path>.";
+      return false;
+    }
+    out.config.list_non_void_calls = true;
+  } else {
+    error = "--profile " + spec.str() + " has unsupported mode \"" + mode +
+            "\".";
+    return false;
+  }
+
+  if (functions_path.empty()) {
+    return true;
+  }
+  return LoadNotableFunctions(functions_path, out.notable_functions,
+                              out.handler_functions, out.logger_functions,
+                              error);
+}
+#endif // ERRORCK_PLUGIN
+
+static bool CompilePathPatterns(const std::vector<std::string> &patterns,
+                                const char *flag,
+                                std::vector<llvm::Regex> &out,
+                                std::string &error) {
+  for (const std::string &pattern : patterns) {
+    llvm::Regex regex(pattern);
+    std::string regex_error;
+    if (!regex.isValid(regex_error)) {
+      error = std::string("Invalid ") + flag + " pattern \"" + pattern +
+              "\": " + regex_error;
+      return false;
+    }
+    out.push_back(std::move(regex));
+  }
+  return true;
+}
+
+static void AssignHandlerGroups(std::vector<AnalysisProfile> &profiles) {
+  for (size_t i = 0; i < profiles.size(); ++i) {
+    profiles[i].handler_group = i;
+    for (size_t j = 0; j < i; ++j) {
+      if (profiles[j].handler_functions == profiles[i].handler_functions &&
+          profiles[j].logger_functions == profiles[i].logger_functions) {
+        profiles[i].handler_group = profiles[j].handler_group;
+        break;
+      }
+    }
+  }
+}
+
 static bool IsErrnoAccessorName(llvm::StringRef name) {
   return name == "__errno_location" || name == "__error";
 }
@@ -315,11 +746,6 @@ static bool IsErrnoExpr(const clang::Expr *expr) {
   return false;
 }
 
-struct CalleeName {
-  std::string name = kDynamicCalleeName;
-  bool stable = false;
-};
-
 static bool IsFunctionLikeType(clang::QualType type) {
   const clang::Type *type_ptr = type.getTypePtrOrNull();
   if (!type_ptr) {
@@ -341,58 +767,101 @@ static const clang::Expr *StripCalleeWrappers(const clang::Expr *expr) {
   return nullptr;
 }
 
+static bool HasName(const clang::NamedDecl *decl) {
+  return decl && !decl->getDeclName().isEmpty();
+}
+
 // We only attach stable names when the callee is directly known (function or
-// struct member). Other indirect calls keep a placeholder so reports stay
-// readable and deterministic.
-static CalleeName GetCalleeName(const clang::CallExpr *call_expr) {
-  CalleeName result;
+// struct member). Other indirect calls return nullptr and are reported with a
+// placeholder name so reports stay readable and deterministic.
+static const clang::NamedDecl *GetCalleeDecl(const clang::CallExpr *call_expr) {
   if (!call_expr) {
-    return result;
+    return nullptr;
   }
 
-  if (const auto *direct = call_expr->getDirectCallee()) {
-    std::string name = direct->getNameAsString();
-    if (!name.empty()) {
-      result.name = std::move(name);
-      result.stable = true;
-      return result;
-    }
+  const clang::FunctionDecl *direct = call_expr->getDirectCallee();
+  if (HasName(direct)) {
+    return direct;
   }
 
   const clang::Expr *callee = StripCalleeWrappers(call_expr->getCallee());
   if (!callee) {
-    return result;
+    return nullptr;
   }
 
   if (!IsFunctionLikeType(callee->getType())) {
-    return result;
+    return nullptr;
   }
 
   if (const auto *member = llvm::dyn_cast<clang::MemberExpr>(callee)) {
-    const auto *named = member->getMemberDecl();
-    if (named) {
-      std::string name = named->getNameAsString();
-      if (!name.empty()) {
-        result.name = std::move(name);
-        result.stable = true;
-      }
-    }
-    return result;
+    const clang::ValueDecl *named = member->getMemberDecl();
+    return HasName(named) ? named : nullptr;
   }
 
   if (const auto *decl_ref = llvm::dyn_cast<clang::DeclRefExpr>(callee)) {
-    if (const auto *decl =
-            llvm::dyn_cast<clang::FunctionDecl>(decl_ref->getDecl())) {
-      std::string name = decl->getNameAsString();
-      if (!name.empty()) {
-        result.name = std::move(name);
-        result.stable = true;
+    const auto *decl = llvm::dyn_cast<clang::FunctionDecl>(decl_ref->getDecl());
+    return HasName(decl) ? decl : nullptr;
+  }
+
+  return nullptr;
+}
+
+// What one profile's functions file says about a callee.
+struct CalleeSelection {
+  bool notable = false;
+  ErrorReportingType reporting = ErrorReportingType::kReturnValue;
+  bool handler = false;
+  bool logger = false;
+};
+
+// Callee names and their per-profile selection, resolved once per distinct
+// callee declaration in a translation unit. Every later check, at call sites
+// and for calls inside statements scanned for handler or logger use, is a
+// pointer-keyed lookup instead of building and hashing the callee name.
+class CalleeCache {
+public:
+  struct Entry {
+    std::string name;
+    llvm::SmallVector<CalleeSelection, 4> profiles;
+  };
+
+  explicit CalleeCache(const std::vector<AnalysisProfile> &profiles)
+      : profiles_(profiles) {}
+
+  // The returned entry stays valid for the lifetime of the cache.
+  const Entry &Lookup(const clang::CallExpr *call_expr) {
+    const clang::NamedDecl *decl = GetCalleeDecl(call_expr);
+    if (decl) {
+      decl = llvm::cast<clang::NamedDecl>(decl->getCanonicalDecl());
+    }
+    auto [it, inserted] = index_.try_emplace(decl, nullptr);
+    if (!inserted) {
+      return *it->second;
+    }
+
+    Entry &entry = entries_.emplace_back();
+    entry.name = decl ? decl->getNameAsString() : kDynamicCalleeName;
+    for (const AnalysisProfile &profile : profiles_) {
+      CalleeSelection selection;
+      auto notable = profile.notable_functions.find(entry.name);
+      if (notable != profile.notable_functions.end()) {
+        selection.notable = true;
+        selection.reporting = notable->second;
       }
+      selection.handler = profile.handler_functions.count(entry.name) != 0;
+      selection.logger = profile.logger_functions.count(entry.name) != 0;
+      entry.profiles.push_back(selection);
     }
+    it->second = &entry;
+    return entry;
   }
 
-  return result;
-}
+private:
+  const std::vector<AnalysisProfile> &profiles_;
+  // A deque so entries never move as more callees are added.
+  std::deque<Entry> entries_;
+  llvm::DenseMap<const clang::NamedDecl *, const Entry *> index_;
+};
 
 // Visits a statement to see if "errno" or one of it's equivalent definitions
 // is present in it. The result is stored in `found`.
@@ -618,14 +1087,37 @@ static bool IsExplicitVoidCastExpr(const clang::Expr *expr) {
   return cast && cast->getType()->isVoidType();
 }
 
-static bool IsCallInSet(const clang::CallExpr *expr,
-                        const std::unordered_set<std::string> &names) {
-  if (!expr) {
-    return false;
+// Records the variables a statement references and whether it calls an errno
+// accessor. Those are the only things that make AnalyzeStatementForVar see a
+// use of a tracked variable, so statements with neither can be skipped.
+class StatementReferenceVisitor
+    : public clang::RecursiveASTVisitor<StatementReferenceVisitor> {
+public:
+  StatementReferenceVisitor(
+      llvm::SmallPtrSetImpl<const clang::VarDecl *> &vars,
+      bool &calls_errno_accessor)
+      : vars_(vars), calls_errno_accessor_(calls_errno_accessor) {}
+
+  bool VisitDeclRefExpr(clang::DeclRefExpr *expr) {
+    if (const auto *var = llvm::dyn_cast<clang::VarDecl>(expr->getDecl())) {
+      vars_.insert(var);
+    }
+    return true;
   }
-  CalleeName callee = GetCalleeName(expr);
-  return names.find(callee.name) != names.end();
-}
+
+  bool VisitCallExpr(clang::CallExpr *expr) {
+    if (const auto *callee = expr->getDirectCallee()) {
+      if (IsErrnoAccessorName(callee->getName())) {
+        calls_errno_accessor_ = true;
+      }
+    }
+    return true;
+  }
+
+private:
+  llvm::SmallPtrSetImpl<const clang::VarDecl *> &vars_;
+  bool &calls_errno_accessor_;
+};
 
 struct VarUsageInfo {
   bool handler = false;
@@ -636,11 +1128,9 @@ struct VarUsageInfo {
 // Visits an expression to record how a given variable is used, if at all.
 class VarUsageVisitor : public clang::RecursiveASTVisitor<VarUsageVisitor> {
 public:
-  VarUsageVisitor(const clang::VarDecl *var,
-                  const std::unordered_set<std::string> &handlers,
-                  const std::unordered_set<std::string> &loggers,
-                  VarUsageInfo &info)
-      : var_(var), handlers_(handlers), loggers_(loggers), info_(info) {}
+  VarUsageVisitor(const clang::VarDecl *var, CalleeCache &callees,
+                  size_t profile, VarUsageInfo &info)
+      : var_(var), callees_(callees), profile_(profile), info_(info) {}
 
   bool TraverseCallExpr(clang::CallExpr *expr) {
     Context ctx = CurrentContext();
@@ -650,9 +1140,11 @@ public:
         Mark();
       }
     }
-    if (IsCallInSet(expr, handlers_)) {
+    const CalleeSelection &selection =
+        callees_.Lookup(expr).profiles[profile_];
+    if (selection.handler) {
       arg_ctx = Context::kHandler;
-    } else if (IsCallInSet(expr, loggers_)) {
+    } else if (selection.logger) {
       arg_ctx = Context::kLogger;
     }
 
@@ -706,21 +1198,20 @@ private:
   }
 
   const clang::VarDecl *var_;
-  const std::unordered_set<std::string> &handlers_;
-  const std::unordered_set<std::string> &loggers_;
+  CalleeCache &callees_;
+  size_t profile_;
   VarUsageInfo &info_;
   std::vector<Context> context_stack_;
 };
 
-static VarUsageInfo
-AnalyzeVarUsage(const clang::Stmt *stmt, const clang::VarDecl *var,
-                const std::unordered_set<std::string> &handlers,
-                const std::unordered_set<std::string> &loggers) {
+static VarUsageInfo AnalyzeVarUsage(const clang::Stmt *stmt,
+                                    const clang::VarDecl *var,
+                                    CalleeCache &callees, size_t profile) {
   VarUsageInfo info;
   if (!stmt || !var) {
     return info;
   }
-  VarUsageVisitor visitor(var, handlers, loggers, info);
+  VarUsageVisitor visitor(var, callees, profile, info);
   visitor.TraverseStmt(const_cast<clang::Stmt *>(stmt));
   return info;
 }
@@ -734,10 +1225,9 @@ struct ErrnoUsageInfo {
 // Visits an expression to record how errno is used, if at all.
 class ErrnoUsageVisitor : public clang::RecursiveASTVisitor<ErrnoUsageVisitor> {
 public:
-  ErrnoUsageVisitor(const std::unordered_set<std::string> &handlers,
-                    const std::unordered_set<std::string> &loggers,
+  ErrnoUsageVisitor(CalleeCache &callees, size_t profile,
                     ErrnoUsageInfo &info)
-      : handlers_(handlers), loggers_(loggers), info_(info) {}
+      : callees_(callees), profile_(profile), info_(info) {}
 
   bool TraverseBinaryOperator(clang::BinaryOperator *op) {
     if (op->isAssignmentOp() && IsErrnoExpr(op->getLHS())) {
@@ -755,9 +1245,11 @@ public:
         Mark();
       }
     }
-    if (IsCallInSet(expr, handlers_)) {
+    const CalleeSelection &selection =
+        callees_.Lookup(expr).profiles[profile_];
+    if (selection.handler) {
       arg_ctx = Context::kHandler;
-    } else if (IsCallInSet(expr, loggers_)) {
+    } else if (selection.logger) {
       arg_ctx = Context::kLogger;
     }
 
@@ -821,35 +1313,33 @@ private:
     }
   }
 
-  const std::unordered_set<std::string> &handlers_;
-  const std::unordered_set<std::string> &loggers_;
+  CalleeCache &callees_;
+  size_t profile_;
   ErrnoUsageInfo &info_;
   std::vector<Context> context_stack_;
 };
 
-static ErrnoUsageInfo
-AnalyzeErrnoUsage(const clang::Stmt *stmt,
-                  const std::unordered_set<std::string> &handlers,
-                  const std::unordered_set<std::string> &loggers) {
+static ErrnoUsageInfo AnalyzeErrnoUsage(const clang::Stmt *stmt,
+                                        CalleeCache &callees, size_t profile) {
   ErrnoUsageInfo info;
   if (!stmt) {
     return info;
   }
-  ErrnoUsageVisitor visitor(handlers, loggers, info);
+  ErrnoUsageVisitor visitor(callees, profile, info);
   visitor.TraverseStmt(const_cast<clang::Stmt *>(stmt));
   return info;
 }
 
 class SqliteWriter {
   struct CallKey {
-    std::string name;
-    std::string filename;
+    int64_t function_id = 0;
+    int64_t file_id = 0;
     unsigned line = 0;
     unsigned column = 0;
-    std::string handling_type;
+    HandlingType handling_type = HandlingType::kNone;
 
     bool operator==(const CallKey &other) const {
-      return name == other.name && filename == other.filename &&
+      return function_id == other.function_id && file_id == other.file_id &&
              line == other.line && column == other.column &&
              handling_type == other.handling_type;
     }
@@ -857,32 +1347,32 @@ class SqliteWriter {
 
   struct CallKeyHash {
     size_t operator()(const CallKey &key) const {
-      size_t seed = 0;
-      seed ^= std::hash<std::string>{}(key.name) + 0x9e3779b9 + (seed << 6) +
-              (seed >> 2);
-      seed ^= std::hash<std::string>{}(key.filename) + 0x9e3779b9 +
-              (seed << 6) + (seed >> 2);
-      seed ^= std::hash<unsigned>{}(key.line) + 0x9e3779b9 + (seed << 6) +
-              (seed >> 2);
-      seed ^= std::hash<unsigned>{}(key.column) + 0x9e3779b9 + (seed << 6) +
-              (seed >> 2);
-      seed ^= std::hash<std::string>{}(key.handling_type) + 0x9e3779b9 +
-              (seed << 6) + (seed >> 2);
-      return seed;
+      return llvm::hash_combine(key.function_id, key.file_id, key.line,
+                                key.column,
+                                static_cast<int>(key.handling_type));
     }
   };
 
 public:
   ~SqliteWriter() {
-    if (insert_stmt_) {
-      sqlite3_finalize(insert_stmt_);
+    if (db_ && ok()) {
+      CommitTransaction();
+    } else if (db_) {
+      RollbackTransaction();
+    }
+    for (sqlite3_stmt *stmt : {insert_stmt_, insert_file_stmt_,
+                               insert_function_stmt_}) {
+      if (stmt) {
+        sqlite3_finalize(stmt);
+      }
     }
     if (db_) {
       sqlite3_close(db_);
     }
   }
 
-  bool Open(const std::string &path, bool overwrite, std::string &error) {
+  bool Open(const std::string &path, bool overwrite, bool bulk_load,
+            std::string &error) {
     std::error_code ec;
     std::filesystem::path db_path(path);
     bool exists = std::filesystem::exists(db_path, ec);
@@ -910,6 +1400,7 @@ public:
     }
 
     int rc = sqlite3_open(path.c_str(), &db_);
+    char *errmsg = nullptr;
     if (rc != SQLITE_OK) {
       error = "Failed to open database: " +
               std::string(db_ ? sqlite3_errmsg(db_) : sqlite3_errstr(rc));
@@ -920,36 +1411,27 @@ public:
       return false;
     }
 
-    const char *schema_sql = "CREATE TABLE IF NOT EXISTS watched_calls ("
-                             "    id INTEGER PRIMARY KEY,"
-                             "    name TEXT NOT NULL,"
-                             "    filename TEXT NOT NULL,"
-                             "    line INTEGER NOT NULL,"
-                             "    column INTEGER NOT NULL,"
-                             "    handling_type TEXT NOT NULL,"
-                             "    assigned_filename TEXT,"
-                             "    assigned_line INTEGER,"
-                             "    assigned_column INTEGER"
-                             ");";
-    char *errmsg = nullptr;
-    rc = sqlite3_exec(db_, schema_sql, nullptr, nullptr, &errmsg);
-    if (rc != SQLITE_OK) {
-      error = "Failed to initialize schema: " +
-              std::string(errmsg ? errmsg : sqlite3_errmsg(db_));
-      sqlite3_free(errmsg);
-      sqlite3_close(db_);
-      db_ = nullptr;
-      return false;
+    if (bulk_load) {
+      // The database is rebuilt from scratch on every run, so durability
+      // against power loss buys nothing; trade it for insert throughput.
+      const char *pragma_sql = "PRAGMA journal_mode = MEMORY;"
+                               "PRAGMA synchronous = OFF;"
+                               "PRAGMA temp_store = MEMORY;"
+                               "PRAGMA cache_size = -262144;";
+      rc = sqlite3_exec(db_, pragma_sql, nullptr, nullptr, &errmsg);
+      if (rc != SQLITE_OK) {
+        error = "Failed to apply bulk load settings: " +
+                std::string(errmsg ? errmsg : sqlite3_errmsg(db_));
+        sqlite3_free(errmsg);
+        sqlite3_close(db_);
+        db_ = nullptr;
+        return false;
+      }
     }
 
-    // Enforce uniqueness in the database so duplicate call sites across
-    // translation units are ignored consistently.
-    const char *unique_sql =
-        "CREATE UNIQUE INDEX IF NOT EXISTS watched_calls_unique "
-        "ON watched_calls (name, filename, line, column, handling_type);";
-    rc = sqlite3_exec(db_, unique_sql, nullptr, nullptr, &errmsg);
+    rc = sqlite3_exec(db_, kOutputSchemaSql, nullptr, nullptr, &errmsg);
     if (rc != SQLITE_OK) {
-      error = "Failed to initialize uniqueness index: " +
+      error = "Failed to initialize schema: " +
               std::string(errmsg ? errmsg : sqlite3_errmsg(db_));
       sqlite3_free(errmsg);
       sqlite3_close(db_);
@@ -958,10 +1440,24 @@ public:
     }
 
     // Keep results deterministic when reusing a database path across runs.
-    rc = sqlite3_exec(db_, "DELETE FROM watched_calls;", nullptr, nullptr,
-                      &errmsg);
+    // Handling types are fixed, so their ids are simply the enum values.
+    std::string reset_sql = "DELETE FROM calls;"
+                            "DELETE FROM call_counts;"
+                            "DELETE FROM call_examples;"
+                            "DELETE FROM skipped_translation_units;"
+                            "DELETE FROM translation_unit_stats;"
+                            "DELETE FROM files;"
+                            "DELETE FROM functions;"
+                            "DELETE FROM handling_types;";
+    for (int type = static_cast<int>(HandlingType::kIgnored);
+         type <= static_cast<int>(HandlingType::kObservedNonVoid); ++type) {
+      reset_sql += "INSERT INTO handling_types (id, name) VALUES (" +
+                   std::to_string(type) + ", '" +
+                   HandlingTypeName(static_cast<HandlingType>(type)) + "');";
+    }
+    rc = sqlite3_exec(db_, reset_sql.c_str(), nullptr, nullptr, &errmsg);
     if (rc != SQLITE_OK) {
-      error = "Failed to clear watched_calls: " +
+      error = "Failed to reset output tables: " +
               std::string(errmsg ? errmsg : sqlite3_errmsg(db_));
       sqlite3_free(errmsg);
       sqlite3_close(db_);
@@ -970,48 +1466,88 @@ public:
     }
 
     const char *insert_sql =
-        "INSERT OR IGNORE INTO watched_calls (name, filename, line, column, "
-        "handling_type, assigned_filename, assigned_line, assigned_column) "
-        "VALUES (?, ?, ?, ?, ?, ?, ?, ?);";
-    rc = sqlite3_prepare_v2(db_, insert_sql, -1, &insert_stmt_, nullptr);
-    if (rc != SQLITE_OK) {
-      error = "Failed to prepare insert statement: " +
-              std::string(sqlite3_errmsg(db_));
-      sqlite3_close(db_);
-      db_ = nullptr;
-      insert_stmt_ = nullptr;
+        "INSERT OR IGNORE INTO calls (file_id, line, column, function_id, "
+        "handling_type_id, id, assigned_file_id, assigned_line, "
+        "assigned_column) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);";
+    if (!Prepare(insert_sql, insert_stmt_, error) ||
+        !Prepare("INSERT INTO files (path) VALUES (?);", insert_file_stmt_,
+                 error) ||
+        !Prepare("INSERT INTO functions (name) VALUES (?);",
+                 insert_function_stmt_, error)) {
       return false;
     }
 
     seen_calls_.clear();
+    file_ids_.clear();
+    function_ids_.clear();
+    counts_.clear();
+    next_call_id_ = 1;
     return true;
   }
 
-  bool InsertCall(const std::string &name, const std::string &filename,
-                  unsigned line, unsigned column,
-                  const std::string &handling_type,
-                  const std::optional<AssignedLocation> &assigned) {
+  // Switches the writer to counting unique call sites per function and
+  // handling type. Counts are merged across translation units in memory and
+  // only written by Finish.
+  void SetAggregate(unsigned max_examples) {
+    aggregate_ = true;
+    max_examples_ = max_examples;
+  }
+
+  // Not thread-safe: rows must be funneled through the committer's writer
+  // thread (see OrderedRowCommitter) so the dedup set and statement are never
+  // shared.
+  bool InsertCall(const CallRecord &record) {
     if (!error_message_.empty()) {
       return false;
     }
 
-    CallKey key{name, filename, line, column, handling_type};
+    // Dimension rows are inserted inside the batch transaction as well.
+    if (!BeginTransaction()) {
+      return false;
+    }
+
+    CallKey key;
+    key.line = record.line;
+    key.column = record.column;
+    key.handling_type = record.handling_type;
+    if (!Intern(insert_function_stmt_, function_ids_, record.name,
+                key.function_id) ||
+        !Intern(insert_file_stmt_, file_ids_, record.filename, key.file_id)) {
+      return false;
+    }
     // Avoid double-counting when the same location is seen multiple times
     // (e.g. headers included repeatedly).
     if (seen_calls_.find(key) != seen_calls_.end()) {
       return true;
     }
+    if (aggregate_) {
+      seen_calls_.insert(key);
+      CallCount &count = counts_[{key.function_id,
+                                  static_cast<int>(key.handling_type)}];
+      ++count.count;
+      if (count.examples.size() < max_examples_) {
+        count.examples.push_back(key);
+      }
+      return true;
+    }
 
-    if (sqlite3_bind_text(insert_stmt_, 1, name.c_str(), -1,
-                          SQLITE_TRANSIENT) != SQLITE_OK ||
-        sqlite3_bind_text(insert_stmt_, 2, filename.c_str(), -1,
-                          SQLITE_TRANSIENT) != SQLITE_OK ||
-        sqlite3_bind_int(insert_stmt_, 3, static_cast<int>(line)) !=
+    const std::optional<AssignedLocation> &assigned = record.assigned;
+    int64_t assigned_file_id = 0;
+    if (assigned && !Intern(insert_file_stmt_, file_ids_, assigned->filename,
+                            assigned_file_id)) {
+      return false;
+    }
+
+    if (sqlite3_bind_int64(insert_stmt_, 1, key.file_id) != SQLITE_OK ||
+        sqlite3_bind_int(insert_stmt_, 2, static_cast<int>(record.line)) !=
+            SQLITE_OK ||
+        sqlite3_bind_int(insert_stmt_, 3, static_cast<int>(record.column)) !=
             SQLITE_OK ||
-        sqlite3_bind_int(insert_stmt_, 4, static_cast<int>(column)) !=
+        sqlite3_bind_int64(insert_stmt_, 4, key.function_id) != SQLITE_OK ||
+        sqlite3_bind_int(insert_stmt_, 5,
+                         static_cast<int>(record.handling_type)) !=
             SQLITE_OK ||
-        sqlite3_bind_text(insert_stmt_, 5, handling_type.c_str(), -1,
-                          SQLITE_TRANSIENT) != SQLITE_OK) {
+        sqlite3_bind_int64(insert_stmt_, 6, next_call_id_) != SQLITE_OK) {
       SetError("Failed to bind insert parameters");
       sqlite3_reset(insert_stmt_);
       sqlite3_clear_bindings(insert_stmt_);
@@ -1019,11 +1555,11 @@ public:
     }
 
     if (assigned) {
-      if (sqlite3_bind_text(insert_stmt_, 6, assigned->filename.c_str(), -1,
-                            SQLITE_TRANSIENT) != SQLITE_OK ||
-          sqlite3_bind_int(insert_stmt_, 7, static_cast<int>(assigned->line)) !=
+      if (sqlite3_bind_int64(insert_stmt_, 7, assigned_file_id) !=
               SQLITE_OK ||
-          sqlite3_bind_int(insert_stmt_, 8,
+          sqlite3_bind_int(insert_stmt_, 8, static_cast<int>(assigned->line)) !=
+              SQLITE_OK ||
+          sqlite3_bind_int(insert_stmt_, 9,
                            static_cast<int>(assigned->column)) != SQLITE_OK) {
         SetError("Failed to bind assigned parameters");
         sqlite3_reset(insert_stmt_);
@@ -1031,9 +1567,9 @@ public:
         return false;
       }
     } else {
-      if (sqlite3_bind_null(insert_stmt_, 6) != SQLITE_OK ||
-          sqlite3_bind_null(insert_stmt_, 7) != SQLITE_OK ||
-          sqlite3_bind_null(insert_stmt_, 8) != SQLITE_OK) {
+      if (sqlite3_bind_null(insert_stmt_, 7) != SQLITE_OK ||
+          sqlite3_bind_null(insert_stmt_, 8) != SQLITE_OK ||
+          sqlite3_bind_null(insert_stmt_, 9) != SQLITE_OK) {
         SetError("Failed to bind assigned parameters");
         sqlite3_reset(insert_stmt_);
         sqlite3_clear_bindings(insert_stmt_);
@@ -1049,1193 +1585,3711 @@ public:
       return false;
     }
 
-    seen_calls_.insert(std::move(key));
+    seen_calls_.insert(key);
+    ++next_call_id_;
     sqlite3_reset(insert_stmt_);
     sqlite3_clear_bindings(insert_stmt_);
+    if (++rows_in_transaction_ >= kRowsPerTransaction) {
+      return CommitTransaction();
+    }
     return true;
   }
 
-  bool ok() const { return error_message_.empty(); }
+  // Notes a translation unit that --isolate gave up on, so the database says
+  // which sources its rows do not cover.
+  bool RecordSkipped(const std::string &path, const std::string &reason) {
+    if (!ok() || !BeginTransaction()) {
+      return false;
+    }
+    sqlite3_stmt *stmt = nullptr;
+    std::string error;
+    if (!Prepare("INSERT OR REPLACE INTO skipped_translation_units "
+                 "(path, reason) VALUES (?, ?);",
+                 stmt, error)) {
+      SetError("Failed to prepare skipped statement");
+      return false;
+    }
+    bool inserted =
+        sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_TRANSIENT) ==
+            SQLITE_OK &&
+        sqlite3_bind_text(stmt, 2, reason.c_str(), -1, SQLITE_TRANSIENT) ==
+            SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_DONE;
+    if (!inserted) {
+      SetError("Failed to record skipped translation unit");
+    }
+    sqlite3_finalize(stmt);
+    return inserted;
+  }
 
-  const std::string &error_message() const { return error_message_; }
+  bool RecordStats(const std::string &path,
+                   const TranslationUnitStats &stats) {
+    if (!ok() || !BeginTransaction()) {
+      return false;
+    }
+    sqlite3_stmt *stmt = nullptr;
+    std::string error;
+    if (!Prepare("INSERT OR REPLACE INTO translation_unit_stats "
+                 "(path, command_hash, peak_memory_kb, parse_ms, analysis_ms) "
+                 "VALUES (?, ?, ?, ?, ?);",
+                 stmt, error)) {
+      SetError("Failed to prepare stats statement");
+      return false;
+    }
+    bool inserted =
+        sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_TRANSIENT) ==
+            SQLITE_OK &&
+        sqlite3_bind_int64(stmt, 2,
+                           static_cast<sqlite3_int64>(stats.command_hash)) ==
+            SQLITE_OK &&
+        sqlite3_bind_int64(stmt, 3,
+                           static_cast<sqlite3_int64>(stats.peak_memory_kb)) ==
+            SQLITE_OK &&
+        sqlite3_bind_int64(stmt, 4,
+                           static_cast<sqlite3_int64>(stats.parse_ms)) ==
+            SQLITE_OK &&
+        sqlite3_bind_int64(stmt, 5,
+                           static_cast<sqlite3_int64>(stats.analysis_ms)) ==
+            SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_DONE;
+    if (!inserted) {
+      SetError("Failed to record translation unit stats");
+    }
+    sqlite3_finalize(stmt);
+    return inserted;
+  }
 
-private:
-  void SetError(const std::string &message) {
-    if (!error_message_.empty()) {
-      return;
+  // Commits rows still pending in the current batch, and writes the counts
+  // of an aggregated profile. Call before checking ok() at the end of a run.
+  bool Finish() {
+    if (!ok() || (aggregate_ && !WriteCounts())) {
+      RollbackTransaction();
+      return false;
     }
-    error_message_ = message + ": " + sqlite3_errmsg(db_);
+    return CommitTransaction();
   }
 
-  sqlite3 *db_ = nullptr;
-  sqlite3_stmt *insert_stmt_ = nullptr;
-  std::unordered_set<CallKey, CallKeyHash> seen_calls_;
-  std::string error_message_;
-};
+  bool ok() const { return error_message_.empty(); }
 
-class ErrorCheckVisitor : public clang::RecursiveASTVisitor<ErrorCheckVisitor> {
-public:
-  ErrorCheckVisitor(const NotableFunctions &notable_functions,
-                    const AnalysisConfig &analysis_config,
-                    const std::unordered_set<std::string> &handler_functions,
-                    const std::unordered_set<std::string> &logger_functions,
-                    SqliteWriter &writer)
-      : notable_functions_(notable_functions),
-        analysis_config_(analysis_config),
-        handler_functions_(handler_functions),
-        logger_functions_(logger_functions), writer_(writer) {}
+  const std::string &error_message() const { return error_message_; }
 
-  void SetContext(clang::ASTContext &ctx) { ctx_ = &ctx; }
+private:
+  // Rows are batched into explicit transactions so SQLite journals and syncs
+  // once per batch instead of once per row.
+  static constexpr size_t kRowsPerTransaction = 10000;
 
-  bool TraverseStmt(clang::Stmt *S) {
-    if (!S) {
+  bool BeginTransaction() {
+    if (in_transaction_) {
       return true;
     }
+    if (sqlite3_exec(db_, "BEGIN;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+      SetError("Failed to begin transaction");
+      return false;
+    }
+    in_transaction_ = true;
+    return true;
+  }
 
-    if (S->getStmtClass() == clang::Stmt::CallExprClass) {
-      auto *callExpr = cast<clang::CallExpr>(S);
-      if (!ctx_) {
-        return RecursiveASTVisitor::TraverseStmt(S);
-      }
+  bool CommitTransaction() {
+    if (!in_transaction_) {
+      return ok();
+    }
+    in_transaction_ = false;
+    rows_in_transaction_ = 0;
+    if (sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+      SetError("Failed to commit transaction");
+      return false;
+    }
+    return true;
+  }
 
-      auto &ctx = *ctx_;
-      CalleeName callee = GetCalleeName(callExpr);
-      auto func = callee.name;
-      if (analysis_config_.list_non_void_calls) {
-        if (IsNonVoidReturn(callExpr, ctx)) {
-          auto loc = callExpr->getExprLoc();
-          auto presumedLoc = ctx.getSourceManager().getPresumedLoc(loc);
-          std::string filename =
-              presumedLoc.getFilename() ? presumedLoc.getFilename() : "";
-          writer_.InsertCall(
-              func, filename, presumedLoc.getLine(), presumedLoc.getColumn(),
-              HandlingTypeName(HandlingType::kObservedNonVoid), std::nullopt);
-        }
-        return RecursiveASTVisitor::TraverseStmt(S);
-      }
+  // Drops the open batch once a write has failed, so a partial batch never
+  // lands in the database.
+  void RollbackTransaction() {
+    if (!in_transaction_) {
+      return;
+    }
+    in_transaction_ = false;
+    rows_in_transaction_ = 0;
+    sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+  }
 
-      ErrorReportingType reporting = ErrorReportingType::kReturnValue;
-      if (!ShouldAnalyzeCall(callExpr, func, reporting, ctx)) {
-        return RecursiveASTVisitor::TraverseStmt(S);
-      }
+  bool WriteCounts() {
+    if (!ok() || !BeginTransaction()) {
+      return false;
+    }
+    sqlite3_stmt *count_stmt = nullptr;
+    sqlite3_stmt *example_stmt = nullptr;
+    std::string error;
+    if (!Prepare("INSERT INTO call_counts (function_id, handling_type_id, "
+                 "count) VALUES (?, ?, ?);",
+                 count_stmt, error) ||
+        !Prepare("INSERT INTO call_examples (function_id, handling_type_id, "
+                 "file_id, line, column) VALUES (?, ?, ?, ?, ?);",
+                 example_stmt, error)) {
+      SetError("Failed to prepare count statements");
+      sqlite3_finalize(count_stmt);
+      return false;
+    }
 
-      HandlingResult handling;
-      switch (reporting) {
-      case ErrorReportingType::kReturnValue:
-        handling = AnalyzeReturnValue(callExpr, ctx);
-        break;
-      case ErrorReportingType::kErrno:
-        handling = AnalyzeErrno(callExpr, ctx);
-        break;
+    bool written = true;
+    for (const auto &[bucket, count] : counts_) {
+      sqlite3_bind_int64(count_stmt, 1, bucket.first);
+      sqlite3_bind_int(count_stmt, 2, bucket.second);
+      sqlite3_bind_int64(count_stmt, 3, static_cast<int64_t>(count.count));
+      written = sqlite3_step(count_stmt) == SQLITE_DONE;
+      sqlite3_reset(count_stmt);
+      for (const CallKey &example : count.examples) {
+        if (!written) {
+          break;
+        }
+        sqlite3_bind_int64(example_stmt, 1, example.function_id);
+        sqlite3_bind_int(example_stmt, 2,
+                         static_cast<int>(example.handling_type));
+        sqlite3_bind_int64(example_stmt, 3, example.file_id);
+        sqlite3_bind_int(example_stmt, 4, static_cast<int>(example.line));
+        sqlite3_bind_int(example_stmt, 5, static_cast<int>(example.column));
+        written = sqlite3_step(example_stmt) == SQLITE_DONE;
+        sqlite3_reset(example_stmt);
       }
-      if (handling.type == HandlingType::kNone) {
-        handling.type = HandlingType::kUsedOther;
+      if (!written) {
+        SetError("Failed to insert counts");
+        break;
       }
-
-      auto loc = callExpr->getExprLoc();
-      auto presumedLoc = ctx.getSourceManager().getPresumedLoc(loc);
-      std::string filename =
-          presumedLoc.getFilename() ? presumedLoc.getFilename() : "";
-      writer_.InsertCall(func, filename, presumedLoc.getLine(),
-                         presumedLoc.getColumn(),
-                         HandlingTypeName(handling.type), handling.assigned);
     }
-
-    return RecursiveASTVisitor::TraverseStmt(S);
+    sqlite3_finalize(count_stmt);
+    sqlite3_finalize(example_stmt);
+    counts_.clear();
+    return written;
   }
 
-private:
-  bool IsNonVoidReturn(const clang::CallExpr *call_expr,
-                       clang::ASTContext &ctx) const {
-    if (!call_expr) {
+  bool Prepare(const char *sql, sqlite3_stmt *&stmt, std::string &error) {
+    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+      error = "Failed to prepare insert statement: " +
+              std::string(sqlite3_errmsg(db_));
+      stmt = nullptr;
       return false;
     }
-    clang::QualType return_type = call_expr->getCallReturnType(ctx);
-    const clang::Type *type_ptr = return_type.getTypePtrOrNull();
-    return type_ptr && !type_ptr->isVoidType();
+    return true;
   }
 
-  bool ShouldAnalyzeCall(const clang::CallExpr *call_expr,
-                         const std::string &name, ErrorReportingType &reporting,
-                         clang::ASTContext &ctx) const {
-    auto notable_it = notable_functions_.find(name);
-    bool is_notable = notable_it != notable_functions_.end();
-    if (analysis_config_.exclude_notable &&
-        (is_notable ||
-         handler_functions_.find(name) != handler_functions_.end() ||
-         logger_functions_.find(name) != logger_functions_.end())) {
-      return false;
-    }
-
-    if (analysis_config_.analyze_all_non_void) {
-      if (!IsNonVoidReturn(call_expr, ctx)) {
-        return false;
-      }
-      // When analyzing every non-void function, default to return-value
-      // handling because errno usage cannot be inferred from signatures.
-      reporting = ErrorReportingType::kReturnValue;
+  // Looks up the id of `value` in a dimension table, inserting it the first
+  // time it is seen. The tables start out empty, so the cache is complete.
+  bool Intern(sqlite3_stmt *stmt,
+              std::unordered_map<std::string, int64_t> &ids,
+              const std::string &value, int64_t &id) {
+    auto it = ids.find(value);
+    if (it != ids.end()) {
+      id = it->second;
       return true;
     }
-
-    if (!is_notable) {
+    if (sqlite3_bind_text(stmt, 1, value.c_str(), -1, SQLITE_TRANSIENT) !=
+            SQLITE_OK ||
+        sqlite3_step(stmt) != SQLITE_DONE) {
+      SetError("Failed to insert dimension row");
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
       return false;
     }
-    reporting = notable_it->second;
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    id = sqlite3_last_insert_rowid(db_);
+    ids.emplace(value, id);
     return true;
   }
 
-  const clang::Expr *TopLevelExpr(const clang::Expr *expr,
-                                  clang::ASTContext &ctx) const {
-    if (!expr) {
-      return nullptr;
-    }
-    const clang::Stmt *current = expr;
-    const clang::Expr *top = expr;
-    while (true) {
-      auto parents = ctx.getParents(*current);
-      if (parents.empty()) {
-        return top;
-      }
-      if (const auto *parent_expr = parents[0].get<clang::Expr>()) {
-        top = parent_expr;
-        current = parent_expr;
-        continue;
-      }
-      return top;
+  void SetError(const std::string &message) {
+    if (!error_message_.empty()) {
+      return;
     }
+    error_message_ = message + ": " + sqlite3_errmsg(db_);
   }
 
-  bool IsTopLevelExplicitVoidCast(const clang::Expr *expr,
-                                  clang::ASTContext &ctx) const {
-    const clang::Expr *top = TopLevelExpr(expr, ctx);
-    return top && IsExplicitVoidCastExpr(top);
+  sqlite3 *db_ = nullptr;
+  sqlite3_stmt *insert_stmt_ = nullptr;
+  sqlite3_stmt *insert_file_stmt_ = nullptr;
+  sqlite3_stmt *insert_function_stmt_ = nullptr;
+  std::unordered_set<CallKey, CallKeyHash> seen_calls_;
+  std::unordered_map<std::string, int64_t> file_ids_;
+  std::unordered_map<std::string, int64_t> function_ids_;
+  // Preserves commit order in `calls`, which is keyed by location instead.
+  int64_t next_call_id_ = 1;
+
+  struct CallCount {
+    uint64_t count = 0;
+    std::vector<CallKey> examples;
+  };
+
+  bool aggregate_ = false;
+  unsigned max_examples_ = 0;
+  // Keyed by (function id, handling type); ordered so Finish writes the
+  // counts in a stable order.
+  std::map<std::pair<int64_t, int>, CallCount> counts_;
+  bool in_transaction_ = false;
+  size_t rows_in_transaction_ = 0;
+  std::string error_message_;
+};
+
+static uint64_t HashBytes(llvm::StringRef bytes) {
+  return llvm::xxh3_64bits(llvm::arrayRefFromStringRef(bytes));
+}
+
+// Persistent per-translation-unit results for --cache. An entry is replayed
+// only when the translation unit's effective compile command, the analysis
+// configuration, and the contents of every file the frontend entered all
+// match what was recorded when the rows were produced. Anything else is a
+// miss and the translation unit is analyzed (and re-stored) as usual.
+// Rows and input files are stored as compact JSON arrays, both in the --cache
+// database and in the results --isolate workers hand back.
+static std::string ToJson(llvm::json::Value value) {
+  std::string out;
+  llvm::raw_string_ostream stream(out);
+  stream << value;
+  stream.flush();
+  return out;
+}
+
+static llvm::json::Array EncodeRows(const std::vector<CallRecord> &rows) {
+  llvm::json::Array array;
+  for (const CallRecord &record : rows) {
+    llvm::json::Array row{static_cast<int64_t>(record.profile),
+                          record.name,
+                          record.filename,
+                          static_cast<int64_t>(record.line),
+                          static_cast<int64_t>(record.column),
+                          static_cast<int64_t>(record.handling_type)};
+    if (record.assigned) {
+      row.push_back(record.assigned->filename);
+      row.push_back(static_cast<int64_t>(record.assigned->line));
+      row.push_back(static_cast<int64_t>(record.assigned->column));
+    }
+    array.push_back(std::move(row));
   }
+  return array;
+}
 
-  bool IsReturnedCall(const clang::CallExpr *call_expr,
-                      clang::ASTContext &ctx) const {
-    if (!call_expr) {
+static bool DecodeRows(const llvm::json::Value &json,
+                       std::vector<CallRecord> &rows) {
+  const llvm::json::Array *array = json.getAsArray();
+  if (!array) {
+    return false;
+  }
+  for (const llvm::json::Value &value : *array) {
+    const llvm::json::Array *row = value.getAsArray();
+    if (!row || (row->size() != 6 && row->size() != 9)) {
       return false;
     }
-    const clang::Stmt *current = call_expr;
-    while (true) {
-      auto parents = ctx.getParents(*current);
-      if (parents.empty()) {
+    std::optional<int64_t> profile = (*row)[0].getAsInteger();
+    std::optional<llvm::StringRef> name = (*row)[1].getAsString();
+    std::optional<llvm::StringRef> filename = (*row)[2].getAsString();
+    std::optional<int64_t> line = (*row)[3].getAsInteger();
+    std::optional<int64_t> column = (*row)[4].getAsInteger();
+    std::optional<int64_t> type = (*row)[5].getAsInteger();
+    if (!profile || !name || !filename || !line || !column || !type ||
+        *type < 0 ||
+        *type > static_cast<int64_t>(HandlingType::kObservedNonVoid)) {
+      return false;
+    }
+    CallRecord record;
+    record.profile = static_cast<size_t>(*profile);
+    record.name = name->str();
+    record.filename = filename->str();
+    record.line = static_cast<unsigned>(*line);
+    record.column = static_cast<unsigned>(*column);
+    record.handling_type = static_cast<HandlingType>(*type);
+    if (row->size() == 9) {
+      std::optional<llvm::StringRef> assigned_filename =
+          (*row)[6].getAsString();
+      std::optional<int64_t> assigned_line = (*row)[7].getAsInteger();
+      std::optional<int64_t> assigned_column = (*row)[8].getAsInteger();
+      if (!assigned_filename || !assigned_line || !assigned_column) {
         return false;
       }
-      if (const auto *parent_expr = parents[0].get<clang::Expr>()) {
-        current = parent_expr;
-        continue;
-      }
-      if (const auto *parent_stmt = parents[0].get<clang::Stmt>()) {
-        const auto *return_stmt =
-            llvm::dyn_cast<clang::ReturnStmt>(parent_stmt);
-        if (!return_stmt) {
-          return false;
-        }
-        const clang::Expr *value = return_stmt->getRetValue();
-        return value && ContainsCallReference(value, call_expr);
-      }
-      return false;
+      record.assigned = AssignedLocation{
+          assigned_filename->str(), static_cast<unsigned>(*assigned_line),
+          static_cast<unsigned>(*assigned_column)};
     }
+    rows.push_back(std::move(record));
+  }
+  return true;
+}
+
+static llvm::json::Array EncodeInputs(const std::vector<InputFile> &inputs) {
+  llvm::json::Array array;
+  for (const InputFile &input : inputs) {
+    array.push_back(
+        llvm::json::Array{input.path, static_cast<int64_t>(input.hash)});
   }
+  return array;
+}
 
-  bool IsExplicitVoidCastStatement(const clang::Stmt *stmt,
-                                   const clang::VarDecl *var) const {
-    if (!stmt || !var) {
+static bool DecodeInputs(const llvm::json::Value &json,
+                         std::vector<InputFile> &inputs) {
+  const llvm::json::Array *array = json.getAsArray();
+  if (!array) {
+    return false;
+  }
+  for (const llvm::json::Value &value : *array) {
+    const llvm::json::Array *input = value.getAsArray();
+    if (!input || input->size() != 2) {
       return false;
     }
-    const auto *expr = llvm::dyn_cast<clang::Expr>(stmt);
-    if (!expr || !IsExplicitVoidCastExpr(expr)) {
+    std::optional<llvm::StringRef> path = (*input)[0].getAsString();
+    std::optional<int64_t> hash = (*input)[1].getAsInteger();
+    if (!path || !hash) {
       return false;
     }
-    return ContainsVarReference(expr, var);
+    inputs.push_back({path->str(), static_cast<uint64_t>(*hash)});
   }
+  return true;
+}
 
-  // We only want calls whose values are unused, so walk up through expression
-  // wrappers and accept statement-position contexts.
-  bool IsIgnoredCallStatement(const clang::CallExpr *CallExpr,
-                              clang::ASTContext &Ctx) const {
-    if (!CallExpr) {
-      return false;
+class ResultCache {
+public:
+  ~ResultCache() {
+    if (lookup_stmt_) {
+      sqlite3_finalize(lookup_stmt_);
     }
+    if (store_stmt_) {
+      sqlite3_finalize(store_stmt_);
+    }
+    if (db_) {
+      sqlite3_close(db_);
+    }
+  }
 
-    const clang::Stmt *Current = CallExpr;
-    while (true) {
-      auto Parents = Ctx.getParents(*Current);
-      if (Parents.empty()) {
-        return false;
-      }
-
-      const clang::Stmt *ParentStmt = Parents[0].get<clang::Stmt>();
-      if (!ParentStmt) {
-        return false;
+  bool Open(const std::string &path, uint64_t config_hash,
+            std::string &error) {
+    config_hash_ = config_hash;
+    int rc = sqlite3_open(path.c_str(), &db_);
+    if (rc != SQLITE_OK) {
+      error = "Failed to open cache: " +
+              std::string(db_ ? sqlite3_errmsg(db_) : sqlite3_errstr(rc));
+      if (db_) {
+        sqlite3_close(db_);
+        db_ = nullptr;
       }
+      return false;
+    }
 
-      if (const auto *parent_expr = llvm::dyn_cast<clang::Expr>(ParentStmt)) {
-        bool is_wrapper =
-            llvm::isa<clang::ParenExpr, clang::ImplicitCastExpr,
-                      clang::ExplicitCastExpr, clang::ExprWithCleanups,
-                      clang::CXXBindTemporaryExpr,
-                      clang::MaterializeTemporaryExpr>(parent_expr);
-        if (!is_wrapper) {
-          return false;
-        }
-        Current = ParentStmt;
-        continue;
-      }
+    // Inputs and rows are stored as JSON so one row holds a whole translation
+    // unit and a lookup is a single primary key read.
+    const char *schema_sql = "CREATE TABLE IF NOT EXISTS translation_units ("
+                             "    source TEXT PRIMARY KEY,"
+                             "    command_hash INTEGER NOT NULL,"
+                             "    config_hash INTEGER NOT NULL,"
+                             "    inputs TEXT NOT NULL,"
+                             "    rows TEXT NOT NULL"
+                             ");";
+    char *errmsg = nullptr;
+    rc = sqlite3_exec(db_, schema_sql, nullptr, nullptr, &errmsg);
+    if (rc != SQLITE_OK) {
+      error = "Failed to initialize cache schema: " +
+              std::string(errmsg ? errmsg : sqlite3_errmsg(db_));
+      sqlite3_free(errmsg);
+      sqlite3_close(db_);
+      db_ = nullptr;
+      return false;
+    }
 
-      if (llvm::isa<clang::CompoundStmt>(ParentStmt)) {
-        return true;
-      }
+    const char *lookup_sql =
+        "SELECT command_hash, config_hash, inputs, rows "
+        "FROM translation_units WHERE source = ?;";
+    const char *store_sql =
+        "INSERT OR REPLACE INTO translation_units "
+        "(source, command_hash, config_hash, inputs, rows) "
+        "VALUES (?, ?, ?, ?, ?);";
+    if (sqlite3_prepare_v2(db_, lookup_sql, -1, &lookup_stmt_, nullptr) !=
+            SQLITE_OK ||
+        sqlite3_prepare_v2(db_, store_sql, -1, &store_stmt_, nullptr) !=
+            SQLITE_OK) {
+      error = "Failed to prepare cache statements: " +
+              std::string(sqlite3_errmsg(db_));
+      return false;
+    }
+    return true;
+  }
 
-      if (const auto *IfStmt = llvm::dyn_cast<clang::IfStmt>(ParentStmt)) {
-        return IfStmt->getThen() == Current || IfStmt->getElse() == Current;
+  // Returns true and fills `rows` when `source` has a valid entry.
+  bool Lookup(const std::string &source, uint64_t command_hash,
+              std::vector<CallRecord> &rows) {
+    std::string inputs_json;
+    std::string rows_json;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      sqlite3_bind_text(lookup_stmt_, 1, source.c_str(), -1, SQLITE_TRANSIENT);
+      bool found = sqlite3_step(lookup_stmt_) == SQLITE_ROW &&
+                   static_cast<uint64_t>(sqlite3_column_int64(
+                       lookup_stmt_, 0)) == command_hash &&
+                   static_cast<uint64_t>(sqlite3_column_int64(
+                       lookup_stmt_, 1)) == config_hash_;
+      if (found) {
+        inputs_json = ColumnText(lookup_stmt_, 2);
+        rows_json = ColumnText(lookup_stmt_, 3);
       }
-
-      if (const auto *WhileStmt =
-              llvm::dyn_cast<clang::WhileStmt>(ParentStmt)) {
-        return WhileStmt->getBody() == Current;
+      sqlite3_reset(lookup_stmt_);
+      sqlite3_clear_bindings(lookup_stmt_);
+      if (!found) {
+        return false;
       }
+    }
 
-      if (const auto *DoStmt = llvm::dyn_cast<clang::DoStmt>(ParentStmt)) {
-        return DoStmt->getBody() == Current;
+    // Validation reads files from disk, so it runs outside the lock.
+    auto inputs_value = llvm::json::parse(inputs_json);
+    std::vector<InputFile> inputs;
+    if (!inputs_value) {
+      llvm::consumeError(inputs_value.takeError());
+      return false;
+    }
+    if (!DecodeInputs(*inputs_value, inputs)) {
+      return false;
+    }
+    for (const InputFile &input : inputs) {
+      uint64_t current = 0;
+      if (!CurrentFileHash(input.path, current) || current != input.hash) {
+        return false;
       }
+    }
+    auto rows_value = llvm::json::parse(rows_json);
+    if (!rows_value) {
+      llvm::consumeError(rows_value.takeError());
+      return false;
+    }
+    return DecodeRows(*rows_value, rows);
+  }
 
-      if (const auto *ForStmt = llvm::dyn_cast<clang::ForStmt>(ParentStmt)) {
-        return ForStmt->getInit() == Current || ForStmt->getInc() == Current ||
-               ForStmt->getBody() == Current;
-      }
+  // Records the result of a successful analysis of `source`.
+  void Store(const std::string &source, uint64_t command_hash,
+             const TranslationUnitOutput &output) {
+    std::string inputs_json = ToJson(EncodeInputs(output.inputs));
+    std::string rows_json = ToJson(EncodeRows(output.rows));
 
-      if (const auto *SwitchStmt =
-              llvm::dyn_cast<clang::SwitchStmt>(ParentStmt)) {
-        return SwitchStmt->getBody() == Current;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sqlite3_bind_text(store_stmt_, 1, source.c_str(), -1,
+                          SQLITE_TRANSIENT) != SQLITE_OK ||
+        sqlite3_bind_int64(store_stmt_, 2,
+                           static_cast<sqlite3_int64>(command_hash)) !=
+            SQLITE_OK ||
+        sqlite3_bind_int64(store_stmt_, 3,
+                           static_cast<sqlite3_int64>(config_hash_)) !=
+            SQLITE_OK ||
+        sqlite3_bind_text(store_stmt_, 4, inputs_json.c_str(), -1,
+                          SQLITE_TRANSIENT) != SQLITE_OK ||
+        sqlite3_bind_text(store_stmt_, 5, rows_json.c_str(), -1,
+                          SQLITE_TRANSIENT) != SQLITE_OK ||
+        sqlite3_step(store_stmt_) != SQLITE_DONE) {
+      if (error_message_.empty()) {
+        error_message_ = "Failed to store cache entry for " + source + ": " +
+                         sqlite3_errmsg(db_);
       }
+    }
+    sqlite3_reset(store_stmt_);
+    sqlite3_clear_bindings(store_stmt_);
+  }
 
-      if (const auto *CaseStmt = llvm::dyn_cast<clang::CaseStmt>(ParentStmt)) {
-        return CaseStmt->getSubStmt() == Current;
-      }
+  bool ok() const { return error_message_.empty(); }
 
-      if (const auto *DefaultStmt =
-              llvm::dyn_cast<clang::DefaultStmt>(ParentStmt)) {
-        return DefaultStmt->getSubStmt() == Current;
-      }
+  const std::string &error_message() const { return error_message_; }
 
-      if (const auto *LabelStmt =
-              llvm::dyn_cast<clang::LabelStmt>(ParentStmt)) {
-        return LabelStmt->getSubStmt() == Current;
-      }
+private:
+  static std::string ColumnText(sqlite3_stmt *stmt, int column) {
+    const unsigned char *text = sqlite3_column_text(stmt, column);
+    return text ? reinterpret_cast<const char *>(text) : "";
+  }
 
-      if (const auto *AttributedStmt =
-              llvm::dyn_cast<clang::AttributedStmt>(ParentStmt)) {
-        return AttributedStmt->getSubStmt() == Current;
+  // Headers are shared by many translation units, so each file is read and
+  // hashed at most once per run.
+  bool CurrentFileHash(const std::string &path, uint64_t &hash) {
+    {
+      std::lock_guard<std::mutex> lock(file_hash_mutex_);
+      auto it = file_hashes_.find(path);
+      if (it != file_hashes_.end()) {
+        if (!it->second) {
+          return false;
+        }
+        hash = *it->second;
+        return true;
       }
+    }
 
+    std::optional<uint64_t> current;
+    auto buffer = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if (buffer) {
+      current = HashBytes((*buffer)->getBuffer());
+    }
+    std::lock_guard<std::mutex> lock(file_hash_mutex_);
+    file_hashes_.emplace(path, current);
+    if (!current) {
       return false;
     }
+    hash = *current;
+    return true;
   }
 
-  const clang::Stmt *FindStatementInCompound(const clang::Stmt *stmt,
-                                             clang::ASTContext &ctx) const {
-    if (!stmt) {
-      return nullptr;
-    }
-
-    const clang::Stmt *current_stmt = stmt;
-    const clang::Decl *current_decl = nullptr;
-
-    while (true) {
-      if (current_stmt) {
-        auto parents = ctx.getParents(*current_stmt);
-        if (parents.empty()) {
-          return nullptr;
-        }
+  sqlite3 *db_ = nullptr;
+  sqlite3_stmt *lookup_stmt_ = nullptr;
+  sqlite3_stmt *store_stmt_ = nullptr;
+  uint64_t config_hash_ = 0;
+  std::mutex mutex_;
+  std::mutex file_hash_mutex_;
+  std::unordered_map<std::string, std::optional<uint64_t>> file_hashes_;
+  std::string error_message_;
+};
 
-        if (const auto *parent_stmt = parents[0].get<clang::Stmt>()) {
-          if (llvm::isa<clang::CompoundStmt>(parent_stmt)) {
-            return current_stmt;
-          }
-          current_stmt = parent_stmt;
-          continue;
-        }
+// Applies an AnalysisScope within one translation unit. Each FileID is
+// resolved once, so the path regexes run once per file rather than once per
+// declaration.
+class FileScopeFilter {
+public:
+  explicit FileScopeFilter(const AnalysisScope &scope) : scope_(scope) {}
 
-        if (const auto *parent_decl = parents[0].get<clang::Decl>()) {
-          current_decl = parent_decl;
-          current_stmt = nullptr;
-          continue;
-        }
+  // Whether declarations at `loc` are analyzed. Locations inside macro
+  // expansions belong to the file the macro is expanded in.
+  bool Contains(const clang::SourceManager &sm, clang::SourceLocation loc) {
+    if (scope_.IsUnrestricted() || loc.isInvalid()) {
+      return true;
+    }
+    clang::FileID file = sm.getFileID(sm.getExpansionLoc(loc));
+    auto [it, inserted] = files_.try_emplace(file, true);
+    if (inserted) {
+      it->second = Resolve(sm, file);
+    }
+    return it->second;
+  }
 
-        return nullptr;
-      }
+private:
+  bool Resolve(const clang::SourceManager &sm, clang::FileID file) const {
+    if (scope_.skip_system_headers &&
+        sm.isInSystemHeader(sm.getLocForStartOfFile(file))) {
+      return false;
+    }
 
-      if (!current_decl) {
-        return nullptr;
-      }
+    clang::OptionalFileEntryRef entry = sm.getFileEntryRefForID(file);
+    if (!entry) {
+      // Builtin and command-line buffers have no path to match.
+      return scope_.include_paths.empty();
+    }
+    llvm::SmallString<256> path(entry->getName());
+    sm.getFileManager().makeAbsolutePath(path);
+    llvm::sys::path::remove_dots(path, /*remove_dot_dot=*/true);
 
-      auto parents = ctx.getParents(*current_decl);
-      if (parents.empty()) {
-        return nullptr;
+    for (const llvm::Regex &exclude : scope_.exclude_paths) {
+      if (exclude.match(path)) {
+        return false;
       }
-
-      if (const auto *parent_stmt = parents[0].get<clang::Stmt>()) {
-        current_stmt = parent_stmt;
-        current_decl = nullptr;
-        continue;
+    }
+    if (scope_.include_paths.empty()) {
+      return true;
+    }
+    for (const llvm::Regex &include : scope_.include_paths) {
+      if (include.match(path)) {
+        return true;
       }
+    }
+    return false;
+  }
 
-      if (const auto *parent_decl = parents[0].get<clang::Decl>()) {
-        current_decl = parent_decl;
-        continue;
-      }
+  const AnalysisScope &scope_;
+  llvm::DenseMap<clang::FileID, bool> files_;
+};
 
-      return nullptr;
-    }
+// Declarations that sit directly in a file. Namespaces and linkage
+// specifications can span several files and members are filtered with their
+// parent, so path filters are only applied at this level. The lexical context
+// is used so out-of-line member definitions are filtered by where they are
+// written, matching the parser's body skipping.
+static bool IsFileLevelDecl(const clang::Decl *decl) {
+  if (llvm::isa<clang::TranslationUnitDecl, clang::NamespaceDecl,
+                clang::LinkageSpecDecl, clang::ExportDecl>(decl)) {
+    return false;
   }
+  const clang::DeclContext *context = decl->getLexicalDeclContext();
+  return context && context->getRedeclContext()->isFileContext();
+}
 
-  bool IsErrnoIgnored(const clang::CallExpr *call_expr,
-                      clang::ASTContext &ctx) const {
-    // Errno checks are typically adjacent to the call, so keep this local to
-    // avoid pretending we have broader dataflow understanding.
-    // TODO: Track errno usage across control flow to reduce false negatives.
-    const clang::Stmt *statement = FindStatementInCompound(call_expr, ctx);
-    if (!statement) {
+// Remembers which header functions have been analyzed during the run. Each
+// one is owned by the lowest-indexed translation unit that reaches it: later
+// translation units skip it, and an earlier one that arrives late takes it
+// over. Rows are committed in translation unit order, by which point the owner
+// of everything a translation unit claimed is final, so the output matches a
+// serial run regardless of which worker finished first.
+class SharedFunctionRegistry {
+public:
+  // Returns true when translation unit `tu` should analyze the function. A
+  // translation unit may claim a function again, since one whose prefix
+  // header fails to load is parsed a second time.
+  bool Claim(const SharedFunctionKey &key, size_t tu) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto [it, inserted] = owners_.try_emplace(key, tu);
+    if (inserted) {
       return true;
     }
-
-    if (ContainsErrnoReference(statement)) {
+    if (it->second < tu) {
       return false;
     }
+    it->second = tu;
+    return true;
+  }
 
-    auto parents = ctx.getParents(*statement);
-    if (parents.empty()) {
-      return true;
-    }
+  bool Owns(const SharedFunctionKey &key, size_t tu) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = owners_.find(key);
+    return it != owners_.end() && it->second == tu;
+  }
+
+private:
+  mutable std::mutex mutex_;
+  llvm::DenseMap<SharedFunctionKey, size_t> owners_;
+};
 
-    const auto *compound = parents[0].get<clang::CompoundStmt>();
-    if (!compound) {
+// One translation unit's side of the SharedFunctionRegistry. Header contents
+// are hashed once per FileID.
+class SharedFunctionClaims {
+public:
+  explicit SharedFunctionClaims(TranslationUnitOutput &output)
+      : output_(output) {}
+
+  bool enabled() const { return output_.shared_registry != nullptr; }
+
+  // Decides whether `function` should be traversed. When it is a header
+  // function this translation unit now owns, `claim` is set to the index its
+  // rows should carry; otherwise `claim` is left alone.
+  bool Claim(const clang::SourceManager &sm,
+             const clang::FunctionDecl *function, int &claim) {
+    std::optional<SharedFunctionKey> key = KeyFor(sm, function);
+    if (!key) {
       return true;
     }
-
-    for (auto it = compound->body_begin(); it != compound->body_end(); ++it) {
-      if (*it == statement) {
-        auto next = it;
-        ++next;
-        if (next != compound->body_end() && ContainsErrnoReference(*next)) {
-          return false;
-        }
-        break;
-      }
+    if (!output_.shared_registry->Claim(*key, output_.index)) {
+      output_.skipped_shared_functions = true;
+      return false;
     }
-
+    claim = static_cast<int>(output_.shared_functions.size());
+    output_.shared_functions.push_back(*key);
     return true;
   }
 
-  enum class StatementUse {
-    kNone,
-    kPropagatedValue,
-    kKilled,
-    kLogged,
-    kBranchedNoCatchall,
-    kBranchedWithCatchall,
-    kPassedToHandlerFn,
-    kReturned,
-    kCastToVoid,
-    kUsedOther,
-  };
-
-  struct TrackingResult {
-    HandlingType type = HandlingType::kNone;
-    std::optional<clang::SourceLocation> assigned_loc;
-  };
-
-  std::optional<AssignedLocation>
-  ToAssignedLocation(clang::SourceLocation loc, clang::ASTContext &ctx) const {
-    if (!loc.isValid()) {
+private:
+  // Only non-template definitions outside the main file are shared; anything
+  // instantiated depends on the including translation unit.
+  std::optional<SharedFunctionKey>
+  KeyFor(const clang::SourceManager &sm,
+         const clang::FunctionDecl *function) {
+    if (!function->doesThisDeclarationHaveABody() ||
+        function->isDependentContext() ||
+        function->getTemplateSpecializationKind() != clang::TSK_Undeclared) {
       return std::nullopt;
     }
-
-    auto presumed = ctx.getSourceManager().getPresumedLoc(loc);
-    if (presumed.isInvalid()) {
+    auto [file, offset] = sm.getDecomposedExpansionLoc(function->getLocation());
+    if (file.isInvalid() || file == sm.getMainFileID() ||
+        !sm.getFileEntryRefForID(file)) {
       return std::nullopt;
     }
-
-    AssignedLocation assigned;
-    assigned.filename = presumed.getFilename() ? presumed.getFilename() : "";
-    assigned.line = presumed.getLine();
-    assigned.column = presumed.getColumn();
-    return assigned;
-  }
-
-  HandlingResult ToHandlingResult(const TrackingResult &tracked,
-                                  clang::ASTContext &ctx) const {
-    HandlingResult result;
-    result.type = tracked.type;
-    if (tracked.type == HandlingType::kAssignedNotRead &&
-        tracked.assigned_loc) {
-      result.assigned = ToAssignedLocation(*tracked.assigned_loc, ctx);
+    auto [it, inserted] = file_hashes_.try_emplace(file, 0);
+    if (inserted) {
+      it->second = HashBytes(sm.getBufferData(file));
     }
-    return result;
+    return SharedFunctionKey(it->second, offset);
   }
 
-  bool FindReturnValueAssignment(const clang::CallExpr *call_expr,
-                                 clang::ASTContext &ctx,
-                                 const clang::VarDecl *&out_var,
-                                 const clang::Stmt *&out_stmt) const {
-    const clang::Stmt *current = call_expr;
-    while (true) {
-      auto parents = ctx.getParents(*current);
-      if (parents.empty()) {
-        return false;
-      }
-
-      if (const auto *parent_expr = parents[0].get<clang::Expr>()) {
-        current = parent_expr;
-        continue;
-      }
+  TranslationUnitOutput &output_;
+  llvm::DenseMap<clang::FileID, uint64_t> file_hashes_;
+};
 
-      if (const auto *parent_decl = parents[0].get<clang::Decl>()) {
-        const auto *var = llvm::dyn_cast<clang::VarDecl>(parent_decl);
-        if (!var || !var->hasLocalStorage()) {
-          return false;
-        }
+class ErrorCheckVisitor : public clang::RecursiveASTVisitor<ErrorCheckVisitor> {
+public:
+  ErrorCheckVisitor(const std::vector<AnalysisProfile> &profiles,
+                    FileScopeFilter &scope, SharedFunctionClaims &claims,
+                    std::vector<CallRecord> &rows)
+      : profiles_(profiles), scope_(scope), claims_(claims), rows_(rows),
+        callees_(profiles) {}
 
-        const clang::Expr *init = var->getInit();
-        if (!init) {
-          return false;
-        }
-        if (init->IgnoreParenImpCasts() !=
-            llvm::cast<clang::Expr>(current)->IgnoreParenImpCasts()) {
-          return false;
-        }
+  void SetContext(clang::ASTContext &ctx) { ctx_ = &ctx; }
 
-        out_stmt = FindStatementInCompound(call_expr, ctx);
-        if (!out_stmt || !llvm::isa<clang::DeclStmt>(out_stmt)) {
-          return false;
-        }
+  // Set when several visitors traverse the same translation unit. The
+  // SourceManager caches lookups internally, and the scope filter and claims
+  // are shared, so every use of them goes through this lock.
+  void SetSourceLock(std::mutex *lock) { source_lock_ = lock; }
+
+  // Traverses one declaration collected by CollectTopLevelDecls() as
+  // traversing the whole translation unit would reach it: with the
+  // declarations lexically enclosing it on the ancestor stack.
+  bool TraverseTopLevelDecl(clang::Decl *D) {
+    llvm::SmallVector<const clang::Decl *, 4> enclosing;
+    for (const clang::DeclContext *context = D->getLexicalDeclContext();
+         context; context = context->getLexicalParent()) {
+      enclosing.push_back(clang::Decl::castFromDeclContext(context));
+    }
+    for (const clang::Decl *decl : llvm::reverse(enclosing)) {
+      ancestors_.push_back(clang::DynTypedNode::create(*decl));
+    }
+    bool result = TraverseDecl(D);
+    ancestors_.resize(ancestors_.size() - enclosing.size());
+    return result;
+  }
 
-        out_var = var;
+  bool TraverseDecl(clang::Decl *D) {
+    if (!D) {
+      return true;
+    }
+    if (ctx_ && IsFileLevelDecl(D)) {
+      std::unique_lock<std::mutex> lock = LockSource();
+      if (!scope_.Contains(ctx_->getSourceManager(), D->getLocation())) {
         return true;
       }
-
-      if (const auto *parent_stmt = parents[0].get<clang::Stmt>()) {
-        const auto *binop = llvm::dyn_cast<clang::BinaryOperator>(parent_stmt);
-        if (!binop || binop->getOpcode() != clang::BO_Assign) {
-          return false;
-        }
-        if (binop->getRHS()->IgnoreParenImpCasts() !=
-            llvm::cast<clang::Expr>(current)->IgnoreParenImpCasts()) {
-          return false;
-        }
-
-        const clang::VarDecl *lhs_var = AsLocalVar(binop->getLHS());
-        if (!lhs_var) {
-          return false;
-        }
-
-        out_stmt = FindStatementInCompound(binop, ctx);
-        if (!out_stmt || !llvm::isa<clang::BinaryOperator>(out_stmt)) {
-          return false;
-        }
-
-        out_var = lhs_var;
+    }
+    // Functions nested in a claimed one (local classes, lambdas) belong to
+    // the outer claim.
+    int enclosing_claim = current_claim_;
+    if (const auto *function = llvm::dyn_cast<clang::FunctionDecl>(D);
+        function && ctx_ && claims_.enabled() && current_claim_ < 0) {
+      std::unique_lock<std::mutex> lock = LockSource();
+      if (!claims_.Claim(ctx_->getSourceManager(), function,
+                         current_claim_)) {
         return true;
       }
-
-      return false;
     }
-  }
-
-  TrackingResult TrackReturnValue(const clang::CallExpr *call_expr,
-                                  clang::ASTContext &ctx) const {
-    const clang::VarDecl *assigned_var = nullptr;
-    const clang::Stmt *assignment_stmt = nullptr;
-    if (!FindReturnValueAssignment(call_expr, ctx, assigned_var,
-                                   assignment_stmt)) {
-      return {};
+    AncestorScope scope(ancestors_, clang::DynTypedNode::create(*D));
+    bool result = RecursiveASTVisitor::TraverseDecl(D);
+    current_claim_ = enclosing_claim;
+    // Flow summaries are only looked up from calls inside the function being
+    // traversed, so drop them once a top-level declaration is done.
+    // Out-of-line member definitions belong to their class but are written
+    // at file scope, so the lexical context decides.
+    const clang::DeclContext *decl_context = D->getLexicalDeclContext();
+    if (decl_context && decl_context->isFileContext()) {
+      flows_.clear();
     }
-
-    return TrackAssignedValue(assignment_stmt, ctx, assigned_var,
-                              call_expr->getExprLoc(), true);
+    return result;
   }
 
-  bool FindErrnoAssignmentInStatement(const clang::Stmt *stmt,
-                                      const clang::VarDecl *&out_var,
-                                      clang::SourceLocation &out_loc) const {
-    if (!stmt) {
-      return false;
+  bool TraverseStmt(clang::Stmt *S) {
+    if (!S) {
+      return true;
     }
+    AncestorScope scope(ancestors_, clang::DynTypedNode::create(*S));
 
-    if (const auto *decl_stmt = llvm::dyn_cast<clang::DeclStmt>(stmt)) {
-      for (const auto *decl : decl_stmt->decls()) {
-        const auto *var = llvm::dyn_cast<clang::VarDecl>(decl);
-        if (!var || !var->hasLocalStorage()) {
-          continue;
-        }
-        const clang::Expr *init = var->getInit();
-        if (!init) {
+    if (S->getStmtClass() == clang::Stmt::CallExprClass) {
+      auto *callExpr = cast<clang::CallExpr>(S);
+      if (!ctx_) {
+        return RecursiveASTVisitor::TraverseStmt(S);
+      }
+
+      auto &ctx = *ctx_;
+      const CalleeCache::Entry &callee = callees_.Lookup(callExpr);
+      const std::string &func = callee.name;
+      llvm::SmallVector<ClassifiedCall, 4> classified;
+      for (size_t i = 0; i < profiles_.size(); ++i) {
+        const AnalysisProfile &profile = profiles_[i];
+        if (profile.config.list_non_void_calls) {
+          if (IsNonVoidReturn(callExpr, ctx)) {
+            RecordCall(i, callExpr, func, HandlingType::kObservedNonVoid,
+                       std::nullopt, ctx);
+          }
           continue;
         }
-        const clang::Expr *unwrapped = init->IgnoreParenImpCasts();
-        if (!IsErrnoExpr(unwrapped)) {
+
+        ErrorReportingType reporting = ErrorReportingType::kReturnValue;
+        if (!ShouldAnalyzeCall(profile, callee.profiles[i], callExpr,
+                               reporting, ctx)) {
           continue;
         }
-        out_var = var;
-        out_loc = unwrapped->getExprLoc();
-        return true;
-      }
-    }
 
-    if (const auto *binop = llvm::dyn_cast<clang::BinaryOperator>(stmt)) {
-      if (binop->getOpcode() != clang::BO_Assign) {
-        return false;
-      }
-      const clang::VarDecl *lhs_var = AsLocalVar(binop->getLHS());
-      if (!lhs_var) {
-        return false;
-      }
-      const clang::Expr *rhs = binop->getRHS()->IgnoreParenImpCasts();
-      if (!IsErrnoExpr(rhs)) {
-        return false;
+        HandlingResult handling =
+            ClassifyCall(profile, callExpr, reporting, classified, ctx);
+        RecordCall(i, callExpr, func, handling.type, handling.assigned, ctx);
       }
-      out_var = lhs_var;
-      out_loc = rhs->getExprLoc();
-      return true;
     }
 
-    return false;
+    return RecursiveASTVisitor::TraverseStmt(S);
   }
 
-  TrackingResult TrackErrnoAssignment(const clang::CallExpr *call_expr,
-                                      clang::ASTContext &ctx) const {
-    const clang::Stmt *call_stmt = FindStatementInCompound(call_expr, ctx);
-    if (!call_stmt) {
-      return {};
-    }
+private:
+  std::unique_lock<std::mutex> LockSource() const {
+    return source_lock_ ? std::unique_lock<std::mutex>(*source_lock_)
+                        : std::unique_lock<std::mutex>();
+  }
 
-    auto parents = ctx.getParents(*call_stmt);
-    if (parents.empty()) {
-      return {};
-    }
-    const auto *compound = parents[0].get<clang::CompoundStmt>();
-    if (!compound) {
-      return {};
+  // Pushes a node onto the ancestor stack for the duration of its traversal.
+  class AncestorScope {
+  public:
+    AncestorScope(llvm::SmallVectorImpl<clang::DynTypedNode> &stack,
+                  const clang::DynTypedNode &node)
+        : stack_(stack) {
+      stack_.push_back(node);
     }
+    ~AncestorScope() { stack_.pop_back(); }
 
-    const clang::VarDecl *assigned_var = nullptr;
-    clang::SourceLocation assigned_loc;
-    const clang::Stmt *assignment_stmt = nullptr;
+  private:
+    llvm::SmallVectorImpl<clang::DynTypedNode> &stack_;
+  };
 
-    if (FindErrnoAssignmentInStatement(call_stmt, assigned_var, assigned_loc)) {
-      assignment_stmt = call_stmt;
-    } else {
-      for (auto it = compound->body_begin(); it != compound->body_end(); ++it) {
-        if (*it != call_stmt) {
-          continue;
-        }
-        auto next = it;
-        ++next;
-        if (next == compound->body_end()) {
-          break;
-        }
-        if (FindErrnoAssignmentInStatement(*next, assigned_var, assigned_loc)) {
-          assignment_stmt = *next;
-        }
-        break;
+  struct ClassifiedCall {
+    size_t handler_group = 0;
+    ErrorReportingType reporting = ErrorReportingType::kReturnValue;
+    HandlingResult result;
+  };
+
+  // Classification only depends on the reporting style and the profile's
+  // handler and logger sets, so profiles that agree on those reuse one result
+  // for the same call.
+  HandlingResult ClassifyCall(const AnalysisProfile &profile,
+                              const clang::CallExpr *call_expr,
+                              ErrorReportingType reporting,
+                              llvm::SmallVectorImpl<ClassifiedCall> &classified,
+                              clang::ASTContext &ctx) {
+    for (const ClassifiedCall &previous : classified) {
+      if (previous.handler_group == profile.handler_group &&
+          previous.reporting == reporting) {
+        return previous.result;
       }
     }
 
-    if (!assignment_stmt) {
-      return {};
+    active_profile_ = static_cast<size_t>(&profile - profiles_.data());
+    HandlingResult handling;
+    switch (reporting) {
+    case ErrorReportingType::kReturnValue:
+      handling = AnalyzeReturnValue(call_expr, ctx);
+      break;
+    case ErrorReportingType::kErrno:
+      handling = AnalyzeErrno(call_expr, ctx);
+      break;
+    }
+    if (handling.type == HandlingType::kNone) {
+      handling.type = HandlingType::kUsedOther;
     }
 
-    return TrackAssignedValue(assignment_stmt, ctx, assigned_var, assigned_loc,
-                              false);
+    ClassifiedCall entry;
+    entry.handler_group = profile.handler_group;
+    entry.reporting = reporting;
+    entry.result = handling;
+    classified.push_back(std::move(entry));
+    return handling;
   }
 
-  const clang::CallExpr *
-  FindEnclosingCallWithArgument(const clang::CallExpr *call_expr,
-                                clang::ASTContext &ctx) const {
-    const clang::Stmt *current = call_expr;
-    while (true) {
-      auto parents = ctx.getParents(*current);
-      if (parents.empty()) {
-        return nullptr;
-      }
+  void RecordCall(size_t profile, const clang::CallExpr *call_expr,
+                  const std::string &name, HandlingType type,
+                  const std::optional<AssignedLocation> &assigned,
+                  clang::ASTContext &ctx) {
+    auto loc = call_expr->getExprLoc();
+    clang::PresumedLoc presumedLoc;
+    {
+      std::unique_lock<std::mutex> lock = LockSource();
+      presumedLoc = ctx.getSourceManager().getPresumedLoc(loc);
+    }
+    CallRecord record;
+    record.profile = profile;
+    record.name = name;
+    record.filename =
+        presumedLoc.getFilename() ? presumedLoc.getFilename() : "";
+    record.line = presumedLoc.getLine();
+    record.column = presumedLoc.getColumn();
+    record.handling_type = type;
+    record.assigned = assigned;
+    record.shared_function = current_claim_;
+    rows_.push_back(std::move(record));
+  }
 
-      if (const auto *parent_call = parents[0].get<clang::CallExpr>()) {
-        for (const auto *arg : parent_call->arguments()) {
-          if (ContainsCallReference(arg, call_expr)) {
-            return parent_call;
-          }
-        }
-      }
+  bool IsNonVoidReturn(const clang::CallExpr *call_expr,
+                       clang::ASTContext &ctx) const {
+    if (!call_expr) {
+      return false;
+    }
+    clang::QualType return_type = call_expr->getCallReturnType(ctx);
+    const clang::Type *type_ptr = return_type.getTypePtrOrNull();
+    return type_ptr && !type_ptr->isVoidType();
+  }
 
-      if (const auto *parent_stmt = parents[0].get<clang::Stmt>()) {
-        current = parent_stmt;
-        continue;
+  bool ShouldAnalyzeCall(const AnalysisProfile &profile,
+                         const CalleeSelection &selection,
+                         const clang::CallExpr *call_expr,
+                         ErrorReportingType &reporting,
+                         clang::ASTContext &ctx) const {
+    if (profile.config.exclude_notable &&
+        (selection.notable || selection.handler || selection.logger)) {
+      return false;
+    }
+
+    if (profile.config.analyze_all_non_void) {
+      if (!IsNonVoidReturn(call_expr, ctx)) {
+        return false;
       }
+      // When analyzing every non-void function, default to return-value
+      // handling because errno usage cannot be inferred from signatures.
+      reporting = ErrorReportingType::kReturnValue;
+      return true;
+    }
 
-      return nullptr;
+    if (!selection.notable) {
+      return false;
     }
+    reporting = selection.reporting;
+    return true;
   }
 
-  const clang::Stmt *NextStatementInCompound(const clang::Stmt *stmt,
-                                             clang::ASTContext &ctx) const {
-    if (!stmt) {
-      return nullptr;
+  // The nodes enclosing `stmt` on the ancestor stack, outermost first. Only
+  // the call being classified and its ancestors are on the stack, so the scan
+  // stops close to the top. Empty for any other statement, such as one found
+  // by lookahead; callers resolve those through the function's flow summary
+  // instead.
+  llvm::ArrayRef<clang::DynTypedNode>
+  AncestorsOf(const clang::Stmt *stmt) const {
+    for (size_t i = ancestors_.size(); i-- > 0;) {
+      if (ancestors_[i].get<clang::Stmt>() == stmt) {
+        return llvm::ArrayRef<clang::DynTypedNode>(ancestors_).take_front(i);
+      }
     }
+    return {};
+  }
 
-    auto parents = ctx.getParents(*stmt);
-    if (parents.empty()) {
-      return nullptr;
-    }
+  const clang::DynTypedNode *ParentOf(const clang::Stmt *stmt) const {
+    llvm::ArrayRef<clang::DynTypedNode> ancestors = AncestorsOf(stmt);
+    return ancestors.empty() ? nullptr : &ancestors.back();
+  }
 
-    const auto *compound = parents[0].get<clang::CompoundStmt>();
-    if (!compound) {
+  const clang::Expr *TopLevelExpr(const clang::Expr *expr) const {
+    if (!expr) {
       return nullptr;
     }
-
-    for (auto it = compound->body_begin(); it != compound->body_end(); ++it) {
-      if (*it == stmt) {
-        auto next = it;
-        ++next;
-        if (next != compound->body_end()) {
-          return *next;
-        }
+    const clang::Expr *top = expr;
+    for (const clang::DynTypedNode &parent :
+         llvm::reverse(AncestorsOf(expr))) {
+      const auto *parent_expr = parent.get<clang::Expr>();
+      if (!parent_expr) {
         break;
       }
+      top = parent_expr;
     }
-
-    return nullptr;
+    return top;
   }
 
-  HandlingType BranchHandlingType(bool has_catchall) const {
-    return has_catchall ? HandlingType::kBranchedWithCatchall
-                        : HandlingType::kBranchedNoCatchall;
+  bool IsTopLevelExplicitVoidCast(const clang::Expr *expr) const {
+    const clang::Expr *top = TopLevelExpr(expr);
+    return top && IsExplicitVoidCastExpr(top);
   }
 
-  bool IfHasCatchall(const clang::IfStmt *stmt) const {
-    const clang::IfStmt *current = stmt;
-    while (current) {
-      const clang::Stmt *else_stmt = current->getElse();
-      if (!else_stmt) {
-        return false;
-      }
-      if (const auto *else_if = llvm::dyn_cast<clang::IfStmt>(else_stmt)) {
-        current = else_if;
+  bool IsReturnedCall(const clang::CallExpr *call_expr) const {
+    if (!call_expr) {
+      return false;
+    }
+    for (const clang::DynTypedNode &parent :
+         llvm::reverse(AncestorsOf(call_expr))) {
+      if (parent.get<clang::Expr>()) {
         continue;
       }
-      return true;
+      const auto *return_stmt = parent.get<clang::ReturnStmt>();
+      if (!return_stmt) {
+        return false;
+      }
+      const clang::Expr *value = return_stmt->getRetValue();
+      return value && ContainsCallReference(value, call_expr);
     }
     return false;
   }
 
-  bool SwitchHasDefault(const clang::SwitchStmt *stmt) const {
-    if (!stmt) {
+  bool IsExplicitVoidCastStatement(const clang::Stmt *stmt,
+                                   const clang::VarDecl *var) const {
+    if (!stmt || !var) {
       return false;
     }
-    for (const auto *case_stmt = stmt->getSwitchCaseList(); case_stmt;
-         case_stmt = case_stmt->getNextSwitchCase()) {
-      if (llvm::isa<clang::DefaultStmt>(case_stmt)) {
-        return true;
-      }
+    const auto *expr = llvm::dyn_cast<clang::Expr>(stmt);
+    if (!expr || !IsExplicitVoidCastExpr(expr)) {
+      return false;
     }
-    return false;
+    return ContainsVarReference(expr, var);
   }
 
-  std::optional<HandlingType>
-  BranchHandlingForCall(const clang::CallExpr *call_expr,
-                        clang::ASTContext &ctx) const {
-    const clang::Stmt *statement = FindStatementInCompound(call_expr, ctx);
-    if (!statement) {
-      return std::nullopt;
+  // We only want calls whose values are unused, so walk up through expression
+  // wrappers and accept statement-position contexts.
+  bool IsIgnoredCallStatement(const clang::CallExpr *CallExpr) const {
+    if (!CallExpr) {
+      return false;
     }
 
-    if (const auto *if_stmt = llvm::dyn_cast<clang::IfStmt>(statement)) {
-      if (ContainsCallReference(if_stmt->getCond(), call_expr)) {
-        return BranchHandlingType(IfHasCatchall(if_stmt));
+    const clang::Stmt *Current = CallExpr;
+    for (const clang::DynTypedNode &Parent :
+         llvm::reverse(AncestorsOf(CallExpr))) {
+      const clang::Stmt *ParentStmt = Parent.get<clang::Stmt>();
+      if (!ParentStmt) {
+        return false;
       }
-    }
 
-    if (const auto *switch_stmt =
-            llvm::dyn_cast<clang::SwitchStmt>(statement)) {
-      if (ContainsCallReference(switch_stmt->getCond(), call_expr)) {
-        return BranchHandlingType(SwitchHasDefault(switch_stmt));
+      if (const auto *parent_expr = llvm::dyn_cast<clang::Expr>(ParentStmt)) {
+        bool is_wrapper =
+            llvm::isa<clang::ParenExpr, clang::ImplicitCastExpr,
+                      clang::ExplicitCastExpr, clang::ExprWithCleanups,
+                      clang::CXXBindTemporaryExpr,
+                      clang::MaterializeTemporaryExpr>(parent_expr);
+        if (!is_wrapper) {
+          return false;
+        }
+        Current = ParentStmt;
+        continue;
       }
-    }
 
-    return std::nullopt;
-  }
+      if (llvm::isa<clang::CompoundStmt>(ParentStmt)) {
+        return true;
+      }
 
-  std::optional<HandlingType>
-  BranchHandlingForVarCondition(const clang::Stmt *stmt,
-                                const clang::VarDecl *var) const {
-    if (!stmt || !var) {
-      return std::nullopt;
-    }
+      if (const auto *IfStmt = llvm::dyn_cast<clang::IfStmt>(ParentStmt)) {
+        return IfStmt->getThen() == Current || IfStmt->getElse() == Current;
+      }
 
-    if (const auto *if_stmt = llvm::dyn_cast<clang::IfStmt>(stmt)) {
-      if (ContainsVarReference(if_stmt->getCond(), var)) {
-        return BranchHandlingType(IfHasCatchall(if_stmt));
+      if (const auto *WhileStmt =
+              llvm::dyn_cast<clang::WhileStmt>(ParentStmt)) {
+        return WhileStmt->getBody() == Current;
       }
-    }
 
-    if (const auto *switch_stmt = llvm::dyn_cast<clang::SwitchStmt>(stmt)) {
-      if (ContainsVarReference(switch_stmt->getCond(), var)) {
-        return BranchHandlingType(SwitchHasDefault(switch_stmt));
+      if (const auto *DoStmt = llvm::dyn_cast<clang::DoStmt>(ParentStmt)) {
+        return DoStmt->getBody() == Current;
       }
-    }
 
-    return std::nullopt;
-  }
+      if (const auto *ForStmt = llvm::dyn_cast<clang::ForStmt>(ParentStmt)) {
+        return ForStmt->getInit() == Current || ForStmt->getInc() == Current ||
+               ForStmt->getBody() == Current;
+      }
 
-  std::optional<HandlingType>
-  BranchHandlingForErrnoCondition(const clang::Stmt *stmt) const {
-    if (!stmt) {
-      return std::nullopt;
-    }
+      if (const auto *SwitchStmt =
+              llvm::dyn_cast<clang::SwitchStmt>(ParentStmt)) {
+        return SwitchStmt->getBody() == Current;
+      }
 
-    if (const auto *if_stmt = llvm::dyn_cast<clang::IfStmt>(stmt)) {
-      if (ContainsErrnoReference(if_stmt->getCond())) {
-        return BranchHandlingType(IfHasCatchall(if_stmt));
+      if (const auto *CaseStmt = llvm::dyn_cast<clang::CaseStmt>(ParentStmt)) {
+        return CaseStmt->getSubStmt() == Current;
       }
-    }
 
-    if (const auto *switch_stmt = llvm::dyn_cast<clang::SwitchStmt>(stmt)) {
-      if (ContainsErrnoReference(switch_stmt->getCond())) {
-        return BranchHandlingType(SwitchHasDefault(switch_stmt));
+      if (const auto *DefaultStmt =
+              llvm::dyn_cast<clang::DefaultStmt>(ParentStmt)) {
+        return DefaultStmt->getSubStmt() == Current;
       }
-    }
 
-    return std::nullopt;
-  }
+      if (const auto *LabelStmt =
+              llvm::dyn_cast<clang::LabelStmt>(ParentStmt)) {
+        return LabelStmt->getSubStmt() == Current;
+      }
 
-  HandlingType DirectHandlerLoggerUse(const clang::CallExpr *call_expr,
-                                      clang::ASTContext &ctx) const {
-    const clang::CallExpr *enclosing =
-        FindEnclosingCallWithArgument(call_expr, ctx);
-    if (!enclosing) {
-      return HandlingType::kNone;
-    }
-    if (IsHandlerCall(enclosing)) {
-      return HandlingType::kPassedToHandlerFn;
-    }
-    if (IsLoggerCall(enclosing)) {
-      return HandlingType::kLoggedNotHandled;
+      if (const auto *AttributedStmt =
+              llvm::dyn_cast<clang::AttributedStmt>(ParentStmt)) {
+        return AttributedStmt->getSubStmt() == Current;
+      }
+
+      return false;
     }
-    return HandlingType::kNone;
+    return false;
   }
 
-  HandlingType AnalyzeErrnoStatement(const clang::Stmt *stmt,
-                                     bool &logged) const {
+  // Walks up through expressions and declarations (e.g. from an initializer
+  // to its DeclStmt) to the statement that sits directly in a compound.
+  const clang::Stmt *FindStatementInCompound(const clang::Stmt *stmt) const {
     if (!stmt) {
-      return HandlingType::kNone;
-    }
-
-    ErrnoUsageInfo usage =
-        AnalyzeErrnoUsage(stmt, handler_functions_, logger_functions_);
-    if (usage.handler) {
-      return HandlingType::kPassedToHandlerFn;
-    }
-    if (ContainsReturnOfErrno(stmt)) {
-      return HandlingType::kPropagated;
-    }
-    if (auto branched = BranchHandlingForErrnoCondition(stmt)) {
-      return *branched;
+      return nullptr;
     }
 
-    const clang::VarDecl *assigned_var = nullptr;
-    clang::SourceLocation assigned_loc;
-    if (FindErrnoAssignmentInStatement(stmt, assigned_var, assigned_loc)) {
-      if (usage.logger) {
-        logged = true;
+    const clang::Stmt *current_stmt = stmt;
+    for (const clang::DynTypedNode &parent :
+         llvm::reverse(AncestorsOf(stmt))) {
+      if (const auto *parent_stmt = parent.get<clang::Stmt>()) {
+        if (llvm::isa<clang::CompoundStmt>(parent_stmt)) {
+          return current_stmt;
+        }
+        current_stmt = parent_stmt;
+        continue;
       }
-      return HandlingType::kNone;
-    }
 
-    if (usage.other) {
-      return HandlingType::kUsedOther;
-    }
-    if (usage.logger) {
-      logged = true;
+      if (!parent.get<clang::Decl>()) {
+        return nullptr;
+      }
     }
-    return HandlingType::kNone;
-  }
-
-  HandlingResult MakeResult(HandlingType type) const {
-    HandlingResult result;
-    result.type = type;
-    return result;
+    return nullptr;
   }
 
-  HandlingResult AnalyzeReturnValue(const clang::CallExpr *call_expr,
-                                    clang::ASTContext &ctx) const {
-    if (IsTopLevelExplicitVoidCast(call_expr, ctx)) {
-      return MakeResult(HandlingType::kCastToVoid);
-    }
-
-    HandlingType direct = DirectHandlerLoggerUse(call_expr, ctx);
-    if (direct != HandlingType::kNone) {
-      return MakeResult(direct);
-    }
+  // Def-use summary of one function body, built on its CFG the first time a
+  // value assigned in the body is tracked and shared by every later lookup
+  // in it. Each CFG element is reduced to the statement it belongs to, so
+  // tracking walks whole statements in control-flow order, and statements
+  // remember the variables they reference so only those that mention the
+  // tracked variable (or call an errno accessor) are analyzed.
+  struct FlowEntry {
+    // The statement directly inside a compound that the element is part of.
+    const clang::Stmt *statement = nullptr;
+    // The full expression the element is part of, used in place of
+    // `statement` when that statement encloses the assignment, such as the
+    // condition of the loop it sits in.
+    const clang::Stmt *expression = nullptr;
+  };
 
-    if (IsIgnoredCallStatement(call_expr, ctx)) {
-      return MakeResult(HandlingType::kIgnored);
-    }
+  struct FlowBlock {
+    const clang::CFGBlock *block = nullptr;
+    llvm::SmallVector<FlowEntry, 4> entries;
+  };
 
-    if (IsReturnedCall(call_expr, ctx)) {
-      return MakeResult(HandlingType::kPropagated);
-    }
+  struct StatementReferences {
+    llvm::SmallPtrSet<const clang::VarDecl *, 8> vars;
+    bool calls_errno_accessor = false;
+  };
 
-    if (auto branched = BranchHandlingForCall(call_expr, ctx)) {
-      return MakeResult(*branched);
-    }
+  struct FunctionFlow {
+    std::unique_ptr<clang::CFG> cfg;
+    std::unique_ptr<clang::ParentMap> parents;
+    // Indexed by CFG block ID.
+    std::vector<FlowBlock> blocks;
+    // The (block ID, entry index) pairs where each statement's entries start.
+    llvm::DenseMap<const clang::Stmt *,
+                   llvm::SmallVector<std::pair<unsigned, size_t>, 1>>
+        positions;
+    llvm::DenseMap<const clang::Stmt *, StatementReferences> references;
+  };
 
-    HandlingResult tracked =
-        ToHandlingResult(TrackReturnValue(call_expr, ctx), ctx);
-    if (tracked.type != HandlingType::kNone) {
-      return tracked;
+  // The summary for the innermost function, block or lambda body on the
+  // ancestor stack, or null if its CFG could not be built.
+  FunctionFlow *CurrentFlow() const {
+    for (const clang::DynTypedNode &node : llvm::reverse(ancestors_)) {
+      if (const auto *lambda = node.get<clang::LambdaExpr>()) {
+        return FlowFor(lambda->getCallOperator(), lambda->getBody());
+      }
+      if (const auto *decl = node.get<clang::Decl>()) {
+        if (clang::Stmt *body = decl->getBody()) {
+          return FlowFor(decl, body);
+        }
+      }
     }
-
-    return MakeResult(HandlingType::kUsedOther);
+    return nullptr;
   }
 
-  HandlingResult AnalyzeErrno(const clang::CallExpr *call_expr,
-                              clang::ASTContext &ctx) const {
-    if (IsErrnoIgnored(call_expr, ctx)) {
-      return MakeResult(HandlingType::kIgnored);
+  FunctionFlow *FlowFor(const clang::Decl *decl, clang::Stmt *body) const {
+    auto [it, inserted] = flows_.try_emplace(body);
+    if (!inserted) {
+      return it->second.get();
     }
 
-    const clang::Stmt *statement = FindStatementInCompound(call_expr, ctx);
-    bool logged = false;
-    HandlingType direct = AnalyzeErrnoStatement(statement, logged);
-    if (direct != HandlingType::kNone) {
-      return MakeResult(direct);
+    auto flow = std::make_unique<FunctionFlow>();
+    {
+      // The builder allocates in the ASTContext, which traversal threads
+      // share.
+      std::unique_lock<std::mutex> lock = LockSource();
+      flow->cfg = clang::CFG::buildCFG(decl, body, ctx_,
+                                       clang::CFG::BuildOptions());
     }
-    const clang::Stmt *next = NextStatementInCompound(statement, ctx);
-    if (next) {
-      direct = AnalyzeErrnoStatement(next, logged);
-      if (direct != HandlingType::kNone) {
-        return MakeResult(direct);
-      }
+    if (!flow->cfg) {
+      return nullptr;
     }
+    flow->parents = std::make_unique<clang::ParentMap>(body);
 
-    HandlingResult tracked =
-        ToHandlingResult(TrackErrnoAssignment(call_expr, ctx), ctx);
-    if (tracked.type != HandlingType::kNone) {
-      return tracked;
+    // Declarations of several variables are split into one DeclStmt each;
+    // map those back to the statement in the source.
+    llvm::DenseMap<const clang::DeclStmt *, const clang::DeclStmt *> split;
+    for (const auto &synthetic : flow->cfg->synthetic_stmts()) {
+      split[synthetic.first] = synthetic.second;
     }
 
-    if (logged) {
-      return MakeResult(HandlingType::kLoggedNotHandled);
+    flow->blocks.resize(flow->cfg->getNumBlockIDs());
+    for (const clang::CFGBlock *block : *flow->cfg) {
+      FlowBlock &flow_block = flow->blocks[block->getBlockID()];
+      flow_block.block = block;
+      for (const clang::CFGElement &element : *block) {
+        std::optional<clang::CFGStmt> cfg_stmt =
+            element.getAs<clang::CFGStmt>();
+        if (!cfg_stmt) {
+          continue;
+        }
+        const clang::Stmt *stmt = cfg_stmt->getStmt();
+        if (const auto *decl_stmt = llvm::dyn_cast<clang::DeclStmt>(stmt)) {
+          auto original = split.find(decl_stmt);
+          if (original != split.end()) {
+            stmt = original->second;
+          }
+        }
+
+        FlowEntry entry;
+        entry.expression = stmt;
+        bool in_expression = true;
+        const clang::Stmt *current = stmt;
+        for (const clang::Stmt *parent = flow->parents->getParent(current);
+             parent; parent = flow->parents->getParent(current)) {
+          if (llvm::isa<clang::CompoundStmt>(parent)) {
+            entry.statement = current;
+            break;
+          }
+          in_expression = in_expression && llvm::isa<clang::Expr>(parent);
+          if (in_expression) {
+            entry.expression = parent;
+          }
+          current = parent;
+        }
+        if (!entry.statement) {
+          continue;
+        }
+
+        llvm::SmallVectorImpl<FlowEntry> &entries = flow_block.entries;
+        if (!entries.empty() && entries.back().statement == entry.statement &&
+            entries.back().expression == entry.expression) {
+          continue;
+        }
+        if (entries.empty() || entries.back().statement != entry.statement) {
+          flow->positions[entry.statement].emplace_back(block->getBlockID(),
+                                                        entries.size());
+        }
+        entries.push_back(entry);
+      }
     }
 
-    return MakeResult(HandlingType::kUsedOther);
+    it->second = std::move(flow);
+    return it->second.get();
   }
 
-  bool IsHandlerCall(const clang::CallExpr *call_expr) const {
-    return IsCallInSet(call_expr, handler_functions_);
+  // Whether AnalyzeStatementForVar could classify `stmt` as anything other
+  // than kNone for `var`.
+  bool MayUse(FunctionFlow &flow, const clang::Stmt *stmt,
+              const clang::VarDecl *var) const {
+    auto [it, inserted] = flow.references.try_emplace(stmt);
+    StatementReferences &references = it->second;
+    if (inserted) {
+      StatementReferenceVisitor visitor(references.vars,
+                                        references.calls_errno_accessor);
+      visitor.TraverseStmt(const_cast<clang::Stmt *>(stmt));
+    }
+    return references.calls_errno_accessor || references.vars.count(var);
   }
 
-  bool IsLoggerCall(const clang::CallExpr *call_expr) const {
-    return IsCallInSet(call_expr, logger_functions_);
-  }
+  enum class FlowStep {
+    // Go on to whatever control reaches after the statement.
+    kContinue,
+    // Stop following this path.
+    kStopPath,
+    // Stop the whole walk.
+    kDone,
+  };
 
-  StatementUse AnalyzeStatementForVar(const clang::Stmt *stmt,
-                                      const clang::VarDecl *var,
-                                      const clang::VarDecl *&out_var,
-                                      clang::SourceLocation &out_loc,
-                                      bool allow_cast_to_void) const {
-    if (!stmt || !var) {
-      return StatementUse::kNone;
+  // Calls `visit` on the statements control can reach after `statement`, in
+  // breadth-first order over the CFG. Each statement is visited at most
+  // once; reaching it again along another path repeats its first step.
+  void WalkFollowing(FunctionFlow &flow, const clang::Stmt *statement,
+                     llvm::function_ref<FlowStep(const clang::Stmt *)> visit)
+      const {
+    auto seeds = flow.positions.find(statement);
+    if (seeds == flow.positions.end()) {
+      return;
     }
 
-    VarUsageInfo usage =
-        AnalyzeVarUsage(stmt, var, handler_functions_, logger_functions_);
-    if (usage.handler) {
-      return StatementUse::kPassedToHandlerFn;
+    llvm::SmallPtrSet<const clang::Stmt *, 8> enclosing;
+    for (const clang::Stmt *parent = flow.parents->getParent(statement);
+         parent; parent = flow.parents->getParent(parent)) {
+      enclosing.insert(parent);
+    }
+
+    llvm::DenseMap<const clang::Stmt *, FlowStep> steps;
+    llvm::DenseSet<unsigned> entered;
+    std::deque<std::pair<unsigned, size_t>> queue(seeds->second.begin(),
+                                                  seeds->second.end());
+    while (!queue.empty()) {
+      auto [block_id, index] = queue.front();
+      queue.pop_front();
+      const FlowBlock &block = flow.blocks[block_id];
+      bool path_ended = false;
+      for (; index < block.entries.size() && !path_ended; ++index) {
+        const FlowEntry &entry = block.entries[index];
+        if (entry.statement == statement) {
+          continue;
+        }
+        const clang::Stmt *following = enclosing.count(entry.statement)
+                                           ? entry.expression
+                                           : entry.statement;
+        auto [it, inserted] = steps.try_emplace(following, FlowStep::kContinue);
+        if (inserted) {
+          it->second = visit(following);
+        }
+        if (it->second == FlowStep::kDone) {
+          return;
+        }
+        path_ended = it->second == FlowStep::kStopPath;
+      }
+      if (path_ended) {
+        continue;
+      }
+      for (const clang::CFGBlock *successor : block.block->succs()) {
+        if (successor && entered.insert(successor->getBlockID()).second) {
+          queue.emplace_back(successor->getBlockID(), 0);
+        }
+      }
     }
+  }
 
-    if (ContainsReturnOfVar(stmt, var)) {
-      return StatementUse::kReturned;
+  // The statements control reaches first after `statement`, one per path.
+  llvm::SmallVector<const clang::Stmt *, 2>
+  FollowingStatements(const clang::Stmt *statement) const {
+    llvm::SmallVector<const clang::Stmt *, 2> following;
+    if (FunctionFlow *flow = CurrentFlow()) {
+      WalkFollowing(*flow, statement, [&](const clang::Stmt *next) {
+        following.push_back(next);
+        return FlowStep::kStopPath;
+      });
+    }
+    return following;
+  }
+
+  bool IsErrnoIgnored(const clang::CallExpr *call_expr) const {
+    // Errno checks are typically right after the call, so look at the call's
+    // statement and whatever control reaches next, which may be past the end
+    // of the enclosing block.
+    const clang::Stmt *statement = FindStatementInCompound(call_expr);
+    if (!statement) {
+      return true;
     }
 
-    if (auto branched = BranchHandlingForVarCondition(stmt, var)) {
-      return *branched == HandlingType::kBranchedWithCatchall
-                 ? StatementUse::kBranchedWithCatchall
-                 : StatementUse::kBranchedNoCatchall;
+    if (ContainsErrnoReference(statement)) {
+      return false;
     }
 
-    if (const auto *decl_stmt = llvm::dyn_cast<clang::DeclStmt>(stmt)) {
-      const clang::VarDecl *candidate = nullptr;
-      clang::SourceLocation candidate_loc;
-      for (const auto *decl : decl_stmt->decls()) {
-        const auto *var_decl = llvm::dyn_cast<clang::VarDecl>(decl);
-        if (!var_decl) {
-          continue;
+    return llvm::none_of(FollowingStatements(statement),
+                         [](const clang::Stmt *next) {
+                           return ContainsErrnoReference(next);
+                         });
+  }
+
+  enum class StatementUse {
+    kNone,
+    kPropagatedValue,
+    kKilled,
+    kLogged,
+    kBranchedNoCatchall,
+    kBranchedWithCatchall,
+    kPassedToHandlerFn,
+    kReturned,
+    kCastToVoid,
+    kUsedOther,
+  };
+
+  struct TrackingResult {
+    HandlingType type = HandlingType::kNone;
+    std::optional<clang::SourceLocation> assigned_loc;
+  };
+
+  std::optional<AssignedLocation>
+  ToAssignedLocation(clang::SourceLocation loc, clang::ASTContext &ctx) const {
+    if (!loc.isValid()) {
+      return std::nullopt;
+    }
+
+    clang::PresumedLoc presumed;
+    {
+      std::unique_lock<std::mutex> lock = LockSource();
+      presumed = ctx.getSourceManager().getPresumedLoc(loc);
+    }
+    if (presumed.isInvalid()) {
+      return std::nullopt;
+    }
+
+    AssignedLocation assigned;
+    assigned.filename = presumed.getFilename() ? presumed.getFilename() : "";
+    assigned.line = presumed.getLine();
+    assigned.column = presumed.getColumn();
+    return assigned;
+  }
+
+  HandlingResult ToHandlingResult(const TrackingResult &tracked,
+                                  clang::ASTContext &ctx) const {
+    HandlingResult result;
+    result.type = tracked.type;
+    if (tracked.type == HandlingType::kAssignedNotRead &&
+        tracked.assigned_loc) {
+      result.assigned = ToAssignedLocation(*tracked.assigned_loc, ctx);
+    }
+    return result;
+  }
+
+  bool FindReturnValueAssignment(const clang::CallExpr *call_expr,
+                                 const clang::VarDecl *&out_var,
+                                 const clang::Stmt *&out_stmt) const {
+    const clang::Stmt *current = call_expr;
+    for (const clang::DynTypedNode &parent :
+         llvm::reverse(AncestorsOf(call_expr))) {
+      if (const auto *parent_expr = parent.get<clang::Expr>()) {
+        current = parent_expr;
+        continue;
+      }
+
+      if (const auto *parent_decl = parent.get<clang::Decl>()) {
+        const auto *var = llvm::dyn_cast<clang::VarDecl>(parent_decl);
+        if (!var || !var->hasLocalStorage()) {
+          return false;
         }
-        const clang::Expr *init = var_decl->getInit();
+
+        const clang::Expr *init = var->getInit();
         if (!init) {
-          continue;
-        }
-        if (!ContainsVarReference(init, var)) {
-          continue;
+          return false;
         }
-        const auto *direct = DirectVarReference(init, var);
-        if (direct && var_decl->hasLocalStorage()) {
-          if (candidate && candidate != var_decl) {
-            return StatementUse::kUsedOther;
-          }
-          candidate = var_decl;
-          candidate_loc = direct->getExprLoc();
-          continue;
+        if (init->IgnoreParenImpCasts() !=
+            llvm::cast<clang::Expr>(current)->IgnoreParenImpCasts()) {
+          return false;
         }
-        VarUsageInfo init_usage =
-            AnalyzeVarUsage(init, var, handler_functions_, logger_functions_);
-        if (init_usage.handler) {
-          return StatementUse::kPassedToHandlerFn;
+
+        out_stmt = FindStatementInCompound(call_expr);
+        if (!out_stmt || !llvm::isa<clang::DeclStmt>(out_stmt)) {
+          return false;
         }
-        if (init_usage.other) {
-          return StatementUse::kUsedOther;
+
+        out_var = var;
+        return true;
+      }
+
+      if (const auto *parent_stmt = parent.get<clang::Stmt>()) {
+        const auto *binop = llvm::dyn_cast<clang::BinaryOperator>(parent_stmt);
+        if (!binop || binop->getOpcode() != clang::BO_Assign) {
+          return false;
         }
-        if (init_usage.logger) {
-          return StatementUse::kLogged;
+        if (binop->getRHS()->IgnoreParenImpCasts() !=
+            llvm::cast<clang::Expr>(current)->IgnoreParenImpCasts()) {
+          return false;
         }
-        return StatementUse::kUsedOther;
-      }
-      if (candidate) {
-        out_var = candidate;
-        out_loc = candidate_loc;
-        return StatementUse::kPropagatedValue;
-      }
-    }
 
-    if (const auto *binop = llvm::dyn_cast<clang::BinaryOperator>(stmt)) {
-      if (binop->getOpcode() == clang::BO_Assign) {
         const clang::VarDecl *lhs_var = AsLocalVar(binop->getLHS());
-        bool rhs_contains = ContainsVarReference(binop->getRHS(), var);
-        if (lhs_var == var && !rhs_contains) {
-          return StatementUse::kKilled;
+        if (!lhs_var) {
+          return false;
         }
-        if (rhs_contains) {
-          const auto *direct = DirectVarReference(binop->getRHS(), var);
-          if (direct && lhs_var && lhs_var != var) {
-            out_var = lhs_var;
-            out_loc = direct->getExprLoc();
-            return StatementUse::kPropagatedValue;
-          }
-          VarUsageInfo rhs_usage = AnalyzeVarUsage(
-              binop->getRHS(), var, handler_functions_, logger_functions_);
-          if (rhs_usage.handler) {
-            return StatementUse::kPassedToHandlerFn;
-          }
-          if (rhs_usage.other) {
-            return StatementUse::kUsedOther;
-          }
-          if (rhs_usage.logger) {
-            return StatementUse::kLogged;
-          }
-          return StatementUse::kUsedOther;
+
+        out_stmt = FindStatementInCompound(binop);
+        if (!out_stmt || !llvm::isa<clang::BinaryOperator>(out_stmt)) {
+          return false;
         }
-      }
-    }
 
-    if (IsExplicitVoidCastStatement(stmt, var)) {
-      return allow_cast_to_void ? StatementUse::kCastToVoid
-                                : StatementUse::kUsedOther;
-    }
+        out_var = lhs_var;
+        return true;
+      }
 
-    if (usage.other) {
-      return StatementUse::kUsedOther;
-    }
-    if (usage.logger) {
-      return StatementUse::kLogged;
+      return false;
     }
-
-    return StatementUse::kNone;
+    return false;
   }
 
-  TrackingResult TrackAssignedValue(const clang::Stmt *statement,
-                                    clang::ASTContext &ctx,
-                                    const clang::VarDecl *var,
-                                    clang::SourceLocation assigned_loc,
-                                    bool allow_cast_to_void) const {
-    // Keep the scan local and linear so we don't imply dataflow across blocks.
-    // TODO: Add control-flow-aware tracking so uses across branches aren't
-    // misclassified as unread.
-    if (!statement || !var) {
+  TrackingResult TrackReturnValue(const clang::CallExpr *call_expr) const {
+    const clang::VarDecl *assigned_var = nullptr;
+    const clang::Stmt *assignment_stmt = nullptr;
+    if (!FindReturnValueAssignment(call_expr, assigned_var, assignment_stmt)) {
       return {};
     }
 
-    auto parents = ctx.getParents(*statement);
-    if (parents.empty()) {
-      return {};
-    }
+    return TrackAssignedValue(assignment_stmt, assigned_var,
+                              call_expr->getExprLoc(), true);
+  }
 
-    const auto *compound = parents[0].get<clang::CompoundStmt>();
-    if (!compound) {
-      return {};
+  bool FindErrnoAssignmentInStatement(const clang::Stmt *stmt,
+                                      const clang::VarDecl *&out_var,
+                                      clang::SourceLocation &out_loc) const {
+    if (!stmt) {
+      return false;
     }
 
-    const clang::VarDecl *current_var = var;
-    clang::SourceLocation current_loc = assigned_loc;
-    bool logged = false;
-    bool found = false;
-    for (auto it = compound->body_begin(); it != compound->body_end(); ++it) {
-      if (!found) {
-        if (*it == statement) {
-          found = true;
+    if (const auto *decl_stmt = llvm::dyn_cast<clang::DeclStmt>(stmt)) {
+      for (const auto *decl : decl_stmt->decls()) {
+        const auto *var = llvm::dyn_cast<clang::VarDecl>(decl);
+        if (!var || !var->hasLocalStorage()) {
+          continue;
         }
-        continue;
+        const clang::Expr *init = var->getInit();
+        if (!init) {
+          continue;
+        }
+        const clang::Expr *unwrapped = init->IgnoreParenImpCasts();
+        if (!IsErrnoExpr(unwrapped)) {
+          continue;
+        }
+        out_var = var;
+        out_loc = unwrapped->getExprLoc();
+        return true;
       }
+    }
 
-      const clang::VarDecl *next_var = nullptr;
-      clang::SourceLocation next_loc;
-      switch (AnalyzeStatementForVar(*it, current_var, next_var, next_loc,
-                                     allow_cast_to_void)) {
-      case StatementUse::kNone:
-        break;
-      case StatementUse::kLogged:
-        logged = true;
-        break;
-      case StatementUse::kBranchedNoCatchall: {
-        TrackingResult result;
-        result.type = HandlingType::kBranchedNoCatchall;
-        return result;
-      }
-      case StatementUse::kBranchedWithCatchall: {
-        TrackingResult result;
-        result.type = HandlingType::kBranchedWithCatchall;
-        return result;
-      }
-      case StatementUse::kPassedToHandlerFn: {
-        TrackingResult result;
-        result.type = HandlingType::kPassedToHandlerFn;
-        return result;
-      }
-      case StatementUse::kReturned: {
-        TrackingResult result;
-        result.type = HandlingType::kPropagated;
-        return result;
+    if (const auto *binop = llvm::dyn_cast<clang::BinaryOperator>(stmt)) {
+      if (binop->getOpcode() != clang::BO_Assign) {
+        return false;
       }
-      case StatementUse::kCastToVoid: {
-        TrackingResult result;
-        result.type = HandlingType::kCastToVoid;
-        return result;
+      const clang::VarDecl *lhs_var = AsLocalVar(binop->getLHS());
+      if (!lhs_var) {
+        return false;
       }
-      case StatementUse::kUsedOther: {
-        TrackingResult result;
-        result.type = HandlingType::kUsedOther;
-        return result;
+      const clang::Expr *rhs = binop->getRHS()->IgnoreParenImpCasts();
+      if (!IsErrnoExpr(rhs)) {
+        return false;
       }
-      case StatementUse::kPropagatedValue:
-        current_var = next_var;
-        current_loc = next_loc;
-        break;
-      case StatementUse::kKilled:
-        if (logged) {
-          TrackingResult result;
-          result.type = HandlingType::kLoggedNotHandled;
-          return result;
-        } else {
-          TrackingResult result;
-          result.type = HandlingType::kAssignedNotRead;
-          result.assigned_loc = current_loc;
-          return result;
+      out_var = lhs_var;
+      out_loc = rhs->getExprLoc();
+      return true;
+    }
+
+    return false;
+  }
+
+  TrackingResult TrackErrnoAssignment(const clang::CallExpr *call_expr) const {
+    const clang::Stmt *call_stmt = FindStatementInCompound(call_expr);
+    if (!call_stmt) {
+      return {};
+    }
+
+    const clang::VarDecl *assigned_var = nullptr;
+    clang::SourceLocation assigned_loc;
+    const clang::Stmt *assignment_stmt = nullptr;
+
+    if (FindErrnoAssignmentInStatement(call_stmt, assigned_var, assigned_loc)) {
+      assignment_stmt = call_stmt;
+    } else {
+      for (const clang::Stmt *next : FollowingStatements(call_stmt)) {
+        if (FindErrnoAssignmentInStatement(next, assigned_var, assigned_loc)) {
+          assignment_stmt = next;
+          break;
         }
       }
     }
 
-    if (logged) {
-      TrackingResult result;
-      result.type = HandlingType::kLoggedNotHandled;
-      return result;
+    if (!assignment_stmt) {
+      return {};
     }
-    TrackingResult result;
-    result.type = HandlingType::kAssignedNotRead;
-    result.assigned_loc = current_loc;
-    return result;
+
+    return TrackAssignedValue(assignment_stmt, assigned_var, assigned_loc,
+                              false);
+  }
+
+  const clang::CallExpr *
+  FindEnclosingCallWithArgument(const clang::CallExpr *call_expr) const {
+    for (const clang::DynTypedNode &parent :
+         llvm::reverse(AncestorsOf(call_expr))) {
+      if (const auto *parent_call = parent.get<clang::CallExpr>()) {
+        for (const auto *arg : parent_call->arguments()) {
+          if (ContainsCallReference(arg, call_expr)) {
+            return parent_call;
+          }
+        }
+      }
+
+      if (!parent.get<clang::Stmt>()) {
+        return nullptr;
+      }
+    }
+    return nullptr;
+  }
+
+  HandlingType BranchHandlingType(bool has_catchall) const {
+    return has_catchall ? HandlingType::kBranchedWithCatchall
+                        : HandlingType::kBranchedNoCatchall;
+  }
+
+  bool IfHasCatchall(const clang::IfStmt *stmt) const {
+    const clang::IfStmt *current = stmt;
+    while (current) {
+      const clang::Stmt *else_stmt = current->getElse();
+      if (!else_stmt) {
+        return false;
+      }
+      if (const auto *else_if = llvm::dyn_cast<clang::IfStmt>(else_stmt)) {
+        current = else_if;
+        continue;
+      }
+      return true;
+    }
+    return false;
+  }
+
+  bool SwitchHasDefault(const clang::SwitchStmt *stmt) const {
+    if (!stmt) {
+      return false;
+    }
+    for (const auto *case_stmt = stmt->getSwitchCaseList(); case_stmt;
+         case_stmt = case_stmt->getNextSwitchCase()) {
+      if (llvm::isa<clang::DefaultStmt>(case_stmt)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::optional<HandlingType>
+  BranchHandlingForCall(const clang::CallExpr *call_expr) const {
+    const clang::Stmt *statement = FindStatementInCompound(call_expr);
+    if (!statement) {
+      return std::nullopt;
+    }
+
+    if (const auto *if_stmt = llvm::dyn_cast<clang::IfStmt>(statement)) {
+      if (ContainsCallReference(if_stmt->getCond(), call_expr)) {
+        return BranchHandlingType(IfHasCatchall(if_stmt));
+      }
+    }
+
+    if (const auto *switch_stmt =
+            llvm::dyn_cast<clang::SwitchStmt>(statement)) {
+      if (ContainsCallReference(switch_stmt->getCond(), call_expr)) {
+        return BranchHandlingType(SwitchHasDefault(switch_stmt));
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  std::optional<HandlingType>
+  BranchHandlingForVarCondition(const clang::Stmt *stmt,
+                                const clang::VarDecl *var) const {
+    if (!stmt || !var) {
+      return std::nullopt;
+    }
+
+    if (const auto *if_stmt = llvm::dyn_cast<clang::IfStmt>(stmt)) {
+      if (ContainsVarReference(if_stmt->getCond(), var)) {
+        return BranchHandlingType(IfHasCatchall(if_stmt));
+      }
+    }
+
+    if (const auto *switch_stmt = llvm::dyn_cast<clang::SwitchStmt>(stmt)) {
+      if (ContainsVarReference(switch_stmt->getCond(), var)) {
+        return BranchHandlingType(SwitchHasDefault(switch_stmt));
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  std::optional<HandlingType>
+  BranchHandlingForErrnoCondition(const clang::Stmt *stmt) const {
+    if (!stmt) {
+      return std::nullopt;
+    }
+
+    if (const auto *if_stmt = llvm::dyn_cast<clang::IfStmt>(stmt)) {
+      if (ContainsErrnoReference(if_stmt->getCond())) {
+        return BranchHandlingType(IfHasCatchall(if_stmt));
+      }
+    }
+
+    if (const auto *switch_stmt = llvm::dyn_cast<clang::SwitchStmt>(stmt)) {
+      if (ContainsErrnoReference(switch_stmt->getCond())) {
+        return BranchHandlingType(SwitchHasDefault(switch_stmt));
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  HandlingType DirectHandlerLoggerUse(const clang::CallExpr *call_expr) const {
+    const clang::CallExpr *enclosing = FindEnclosingCallWithArgument(call_expr);
+    if (!enclosing) {
+      return HandlingType::kNone;
+    }
+    if (IsHandlerCall(enclosing)) {
+      return HandlingType::kPassedToHandlerFn;
+    }
+    if (IsLoggerCall(enclosing)) {
+      return HandlingType::kLoggedNotHandled;
+    }
+    return HandlingType::kNone;
+  }
+
+  HandlingType AnalyzeErrnoStatement(const clang::Stmt *stmt,
+                                     bool &logged) const {
+    if (!stmt) {
+      return HandlingType::kNone;
+    }
+
+    ErrnoUsageInfo usage =
+        AnalyzeErrnoUsage(stmt, callees_, active_profile_);
+    if (usage.handler) {
+      return HandlingType::kPassedToHandlerFn;
+    }
+    if (ContainsReturnOfErrno(stmt)) {
+      return HandlingType::kPropagated;
+    }
+    if (auto branched = BranchHandlingForErrnoCondition(stmt)) {
+      return *branched;
+    }
+
+    const clang::VarDecl *assigned_var = nullptr;
+    clang::SourceLocation assigned_loc;
+    if (FindErrnoAssignmentInStatement(stmt, assigned_var, assigned_loc)) {
+      if (usage.logger) {
+        logged = true;
+      }
+      return HandlingType::kNone;
+    }
+
+    if (usage.other) {
+      return HandlingType::kUsedOther;
+    }
+    if (usage.logger) {
+      logged = true;
+    }
+    return HandlingType::kNone;
+  }
+
+  HandlingResult MakeResult(HandlingType type) const {
+    HandlingResult result;
+    result.type = type;
+    return result;
+  }
+
+  HandlingResult AnalyzeReturnValue(const clang::CallExpr *call_expr,
+                                    clang::ASTContext &ctx) const {
+    if (IsTopLevelExplicitVoidCast(call_expr)) {
+      return MakeResult(HandlingType::kCastToVoid);
+    }
+
+    HandlingType direct = DirectHandlerLoggerUse(call_expr);
+    if (direct != HandlingType::kNone) {
+      return MakeResult(direct);
+    }
+
+    if (IsIgnoredCallStatement(call_expr)) {
+      return MakeResult(HandlingType::kIgnored);
+    }
+
+    if (IsReturnedCall(call_expr)) {
+      return MakeResult(HandlingType::kPropagated);
+    }
+
+    if (auto branched = BranchHandlingForCall(call_expr)) {
+      return MakeResult(*branched);
+    }
+
+    HandlingResult tracked = ToHandlingResult(TrackReturnValue(call_expr), ctx);
+    if (tracked.type != HandlingType::kNone) {
+      return tracked;
+    }
+
+    return MakeResult(HandlingType::kUsedOther);
+  }
+
+  HandlingResult AnalyzeErrno(const clang::CallExpr *call_expr,
+                              clang::ASTContext &ctx) const {
+    if (IsErrnoIgnored(call_expr)) {
+      return MakeResult(HandlingType::kIgnored);
+    }
+
+    const clang::Stmt *statement = FindStatementInCompound(call_expr);
+    bool logged = false;
+    HandlingType direct = AnalyzeErrnoStatement(statement, logged);
+    if (direct != HandlingType::kNone) {
+      return MakeResult(direct);
+    }
+    for (const clang::Stmt *next : FollowingStatements(statement)) {
+      direct = AnalyzeErrnoStatement(next, logged);
+      if (direct != HandlingType::kNone) {
+        return MakeResult(direct);
+      }
+    }
+
+    HandlingResult tracked =
+        ToHandlingResult(TrackErrnoAssignment(call_expr), ctx);
+    if (tracked.type != HandlingType::kNone) {
+      return tracked;
+    }
+
+    if (logged) {
+      return MakeResult(HandlingType::kLoggedNotHandled);
+    }
+
+    return MakeResult(HandlingType::kUsedOther);
+  }
+
+  bool IsHandlerCall(const clang::CallExpr *call_expr) const {
+    return callees_.Lookup(call_expr).profiles[active_profile_].handler;
+  }
+
+  bool IsLoggerCall(const clang::CallExpr *call_expr) const {
+    return callees_.Lookup(call_expr).profiles[active_profile_].logger;
+  }
+
+  StatementUse AnalyzeStatementForVar(const clang::Stmt *stmt,
+                                      const clang::VarDecl *var,
+                                      const clang::VarDecl *&out_var,
+                                      clang::SourceLocation &out_loc,
+                                      bool allow_cast_to_void) const {
+    if (!stmt || !var) {
+      return StatementUse::kNone;
+    }
+
+    VarUsageInfo usage =
+        AnalyzeVarUsage(stmt, var, callees_, active_profile_);
+    if (usage.handler) {
+      return StatementUse::kPassedToHandlerFn;
+    }
+
+    if (ContainsReturnOfVar(stmt, var)) {
+      return StatementUse::kReturned;
+    }
+
+    if (auto branched = BranchHandlingForVarCondition(stmt, var)) {
+      return *branched == HandlingType::kBranchedWithCatchall
+                 ? StatementUse::kBranchedWithCatchall
+                 : StatementUse::kBranchedNoCatchall;
+    }
+
+    if (const auto *decl_stmt = llvm::dyn_cast<clang::DeclStmt>(stmt)) {
+      const clang::VarDecl *candidate = nullptr;
+      clang::SourceLocation candidate_loc;
+      for (const auto *decl : decl_stmt->decls()) {
+        const auto *var_decl = llvm::dyn_cast<clang::VarDecl>(decl);
+        if (!var_decl) {
+          continue;
+        }
+        const clang::Expr *init = var_decl->getInit();
+        if (!init) {
+          continue;
+        }
+        if (!ContainsVarReference(init, var)) {
+          continue;
+        }
+        const auto *direct = DirectVarReference(init, var);
+        if (direct && var_decl->hasLocalStorage()) {
+          if (candidate && candidate != var_decl) {
+            return StatementUse::kUsedOther;
+          }
+          candidate = var_decl;
+          candidate_loc = direct->getExprLoc();
+          continue;
+        }
+        VarUsageInfo init_usage =
+            AnalyzeVarUsage(init, var, callees_, active_profile_);
+        if (init_usage.handler) {
+          return StatementUse::kPassedToHandlerFn;
+        }
+        if (init_usage.other) {
+          return StatementUse::kUsedOther;
+        }
+        if (init_usage.logger) {
+          return StatementUse::kLogged;
+        }
+        return StatementUse::kUsedOther;
+      }
+      if (candidate) {
+        out_var = candidate;
+        out_loc = candidate_loc;
+        return StatementUse::kPropagatedValue;
+      }
+    }
+
+    if (const auto *binop = llvm::dyn_cast<clang::BinaryOperator>(stmt)) {
+      if (binop->getOpcode() == clang::BO_Assign) {
+        const clang::VarDecl *lhs_var = AsLocalVar(binop->getLHS());
+        bool rhs_contains = ContainsVarReference(binop->getRHS(), var);
+        if (lhs_var == var && !rhs_contains) {
+          return StatementUse::kKilled;
+        }
+        if (rhs_contains) {
+          const auto *direct = DirectVarReference(binop->getRHS(), var);
+          if (direct && lhs_var && lhs_var != var) {
+            out_var = lhs_var;
+            out_loc = direct->getExprLoc();
+            return StatementUse::kPropagatedValue;
+          }
+          VarUsageInfo rhs_usage =
+              AnalyzeVarUsage(binop->getRHS(), var, callees_, active_profile_);
+          if (rhs_usage.handler) {
+            return StatementUse::kPassedToHandlerFn;
+          }
+          if (rhs_usage.other) {
+            return StatementUse::kUsedOther;
+          }
+          if (rhs_usage.logger) {
+            return StatementUse::kLogged;
+          }
+          return StatementUse::kUsedOther;
+        }
+      }
+    }
+
+    if (IsExplicitVoidCastStatement(stmt, var)) {
+      return allow_cast_to_void ? StatementUse::kCastToVoid
+                                : StatementUse::kUsedOther;
+    }
+
+    if (usage.other) {
+      return StatementUse::kUsedOther;
+    }
+    if (usage.logger) {
+      return StatementUse::kLogged;
+    }
+
+    return StatementUse::kNone;
+  }
+
+  // How the value assigned to `var` by `statement` is used on the paths
+  // through the function that follow it. `statement` must be on the ancestor
+  // stack or have been found through the current function's flow summary.
+  TrackingResult TrackAssignedValue(const clang::Stmt *statement,
+                                    const clang::VarDecl *var,
+                                    clang::SourceLocation assigned_loc,
+                                    bool allow_cast_to_void) const {
+    if (!statement || !var) {
+      return {};
+    }
+
+    FunctionFlow *flow = CurrentFlow();
+    if (!flow || !flow->positions.count(statement)) {
+      return {};
+    }
+    llvm::SmallPtrSet<const clang::Stmt *, 4> propagations;
+    return TrackFrom(*flow, statement, var, assigned_loc, allow_cast_to_void,
+                     propagations);
+  }
+
+  // The first statement reached that reads the value decides, in
+  // breadth-first order over the CFG. A statement that overwrites it ends
+  // only its own path, so a read on any other path still counts.
+  TrackingResult
+  TrackFrom(FunctionFlow &flow, const clang::Stmt *statement,
+            const clang::VarDecl *var, clang::SourceLocation assigned_loc,
+            bool allow_cast_to_void,
+            llvm::SmallPtrSetImpl<const clang::Stmt *> &propagations) const {
+    std::optional<TrackingResult> decided;
+    bool logged = false;
+    WalkFollowing(flow, statement, [&](const clang::Stmt *following) {
+      if (!MayUse(flow, following, var)) {
+        return FlowStep::kContinue;
+      }
+
+      const clang::VarDecl *next_var = nullptr;
+      clang::SourceLocation next_loc;
+      TrackingResult result;
+      switch (AnalyzeStatementForVar(following, var, next_var, next_loc,
+                                     allow_cast_to_void)) {
+      case StatementUse::kNone:
+        return FlowStep::kContinue;
+      case StatementUse::kLogged:
+        logged = true;
+        return FlowStep::kContinue;
+      case StatementUse::kKilled:
+        return FlowStep::kStopPath;
+      case StatementUse::kBranchedNoCatchall:
+        result.type = HandlingType::kBranchedNoCatchall;
+        break;
+      case StatementUse::kBranchedWithCatchall:
+        result.type = HandlingType::kBranchedWithCatchall;
+        break;
+      case StatementUse::kPassedToHandlerFn:
+        result.type = HandlingType::kPassedToHandlerFn;
+        break;
+      case StatementUse::kReturned:
+        result.type = HandlingType::kPropagated;
+        break;
+      case StatementUse::kCastToVoid:
+        result.type = HandlingType::kCastToVoid;
+        break;
+      case StatementUse::kUsedOther:
+        result.type = HandlingType::kUsedOther;
+        break;
+      case StatementUse::kPropagatedValue:
+        // Copies made inside a loop can lead back here.
+        if (!propagations.insert(following).second) {
+          return FlowStep::kStopPath;
+        }
+        result = TrackFrom(flow, following, next_var, next_loc,
+                           allow_cast_to_void, propagations);
+        if (result.type == HandlingType::kNone) {
+          result.type = HandlingType::kUsedOther;
+        }
+        break;
+      }
+      decided = result;
+      return FlowStep::kDone;
+    });
+
+    if (decided && !(logged && decided->type ==
+                                   HandlingType::kAssignedNotRead)) {
+      return *decided;
+    }
+    if (logged) {
+      TrackingResult result;
+      result.type = HandlingType::kLoggedNotHandled;
+      return result;
+    }
+    TrackingResult result;
+    result.type = HandlingType::kAssignedNotRead;
+    result.assigned_loc = assigned_loc;
+    return result;
+  }
+
+  const std::vector<AnalysisProfile> &profiles_;
+  FileScopeFilter &scope_;
+  SharedFunctionClaims &claims_;
+  // Claim index carried by rows from the shared header function being
+  // traversed, or -1.
+  int current_claim_ = -1;
+  std::vector<CallRecord> &rows_;
+  // Index of the profile currently being classified; its handler and logger
+  // sets decide what counts as handling.
+  size_t active_profile_ = 0;
+  mutable CalleeCache callees_;
+  clang::ASTContext *ctx_ = nullptr;
+  std::mutex *source_lock_ = nullptr;
+  // Nodes from the translation unit down to the one being traversed. The
+  // classification helpers walk this instead of ASTContext::getParents(),
+  // which would build a parent map for the whole translation unit.
+  llvm::SmallVector<clang::DynTypedNode, 32> ancestors_;
+  // Flow summaries by function body, built by FlowFor(). Null for bodies
+  // whose CFG could not be built.
+  mutable llvm::DenseMap<const clang::Stmt *, std::unique_ptr<FunctionFlow>>
+      flows_;
+};
+
+// Records every file the source manager loaded for the translation unit. That
+// covers each file the preprocessor entered; hashing the buffers themselves
+// ties the cache entry to exactly the contents that were analyzed.
+static void RecordInputFiles(clang::SourceManager &sm,
+                             std::vector<InputFile> &out) {
+  clang::FileManager &file_manager = sm.getFileManager();
+  for (auto it = sm.fileinfo_begin(); it != sm.fileinfo_end(); ++it) {
+    std::optional<llvm::MemoryBufferRef> buffer =
+        sm.getMemoryBufferForFileOrNone(it->first);
+    if (!buffer) {
+      continue;
+    }
+    llvm::SmallString<256> path(it->first.getName());
+    file_manager.makeAbsolutePath(path);
+    out.push_back({std::string(path), HashBytes(buffer->getBuffer())});
+  }
+}
+
+// The declarations TraverseDecl visits under `context`, with namespaces,
+// linkage specifications and export blocks replaced by their members so that
+// code in C++ namespaces or extern "C" blocks is spread across threads too.
+static void CollectTopLevelDecls(const clang::DeclContext *context,
+                                 std::vector<clang::Decl *> &decls) {
+  for (clang::Decl *decl : context->decls()) {
+    if (llvm::isa<clang::NamespaceDecl, clang::LinkageSpecDecl,
+                  clang::ExportDecl>(decl)) {
+      CollectTopLevelDecls(llvm::cast<clang::DeclContext>(decl), decls);
+      continue;
+    }
+    const auto *record = llvm::dyn_cast<clang::CXXRecordDecl>(decl);
+    if (!llvm::isa<clang::BlockDecl, clang::CapturedDecl>(decl) &&
+        !(record && record->isLambda())) {
+      decls.push_back(decl);
+    }
+  }
+}
+
+// Splits the translation unit's top-level declarations across `jobs` threads.
+// Each thread has its own visitor, and with it its own callee cache and
+// flow summaries, and takes the next declaration whenever it finishes one.
+// Rows are collected per declaration and appended in declaration order, so
+// they come out exactly as a single traversal would produce them.
+static void TraverseInParallel(const std::vector<AnalysisProfile> &profiles,
+                               FileScopeFilter &scope_filter,
+                               SharedFunctionClaims &claims,
+                               clang::ASTContext &context,
+                               const std::vector<clang::Decl *> &decls,
+                               unsigned jobs, std::vector<CallRecord> &rows) {
+  std::vector<std::vector<CallRecord>> decl_rows(decls.size());
+  std::atomic<size_t> next_decl{0};
+  std::mutex source_lock;
+  auto traverse = [&] {
+    std::vector<CallRecord> local_rows;
+    ErrorCheckVisitor visitor(profiles, scope_filter, claims, local_rows);
+    visitor.SetContext(context);
+    visitor.SetSourceLock(&source_lock);
+    for (size_t i = next_decl++; i < decls.size(); i = next_decl++) {
+      visitor.TraverseTopLevelDecl(decls[i]);
+      decl_rows[i] = std::move(local_rows);
+      local_rows.clear();
+    }
+  };
+  llvm::DefaultThreadPool pool(llvm::hardware_concurrency(jobs));
+  for (unsigned i = 0; i < jobs; ++i) {
+    pool.async(traverse);
+  }
+  pool.wait();
+  for (std::vector<CallRecord> &batch : decl_rows) {
+    rows.insert(rows.end(), std::make_move_iterator(batch.begin()),
+                std::make_move_iterator(batch.end()));
+  }
+}
+
+// Outside --isolate, a translation unit's memory is estimated from its AST
+// and source buffers, since other translation units share the process's
+// resident size. The preprocessor, Sema, and allocator slack add to those
+// buffers; the factor for them is an unmeasured guess, not a fit against
+// worker peaks, so only --isolate records measured figures. Scaling keeps the
+// estimate in the same unit as a worker's peak resident size, which
+// --memory-budget compares it against.
+static constexpr uint64_t kResidentBytesPerAstByte = 2;
+
+// Traverses a finished AST and fills in everything of `output` but the parse
+// time, which only the caller knows. A source with several compile commands
+// adds up the time of each and keeps the largest footprint.
+static void AnalyzeTranslationUnit(const std::vector<AnalysisProfile> &profiles,
+                                   FileScopeFilter &scope_filter,
+                                   SharedFunctionClaims &claims,
+                                   clang::ASTContext &context,
+                                   TranslationUnitOutput &output) {
+  auto analysis_start = std::chrono::steady_clock::now();
+  std::vector<clang::Decl *> decls;
+  CollectTopLevelDecls(context.getTranslationUnitDecl(), decls);
+  // Declarations loaded lazily from an AST file would be deserialized from
+  // several threads at once, so those stay on one thread.
+  unsigned jobs = static_cast<unsigned>(
+      std::min<size_t>(output.intra_tu_jobs, decls.size()));
+  if (jobs > 1 && !context.getExternalSource()) {
+    TraverseInParallel(profiles, scope_filter, claims, context, decls, jobs,
+                       output.rows);
+  } else {
+    ErrorCheckVisitor visitor(profiles, scope_filter, claims, output.rows);
+    visitor.SetContext(context);
+    visitor.TraverseDecl(context.getTranslationUnitDecl());
+  }
+  output.analysis_ms += MillisecondsSince(analysis_start);
+  if (output.record_inputs) {
+    RecordInputFiles(context.getSourceManager(), output.inputs);
+  }
+  clang::SourceManager::MemoryBufferSizes buffers =
+      context.getSourceManager().getMemoryBufferSizes();
+  uint64_t ast_bytes = context.getASTAllocatedMemory() +
+                       context.getSideTableAllocatedMemory() +
+                       buffers.malloc_bytes + buffers.mmap_bytes;
+  output.peak_memory_kb = std::max<uint64_t>(
+      output.peak_memory_kb, ast_bytes * kResidentBytesPerAstByte / 1024);
+}
+
+class ErrorCheckConsumer : public clang::ASTConsumer {
+public:
+  ErrorCheckConsumer(const std::vector<AnalysisProfile> &profiles,
+                     const AnalysisScope &scope, TranslationUnitOutput &output)
+      : profiles_(profiles), ScopeFilter(scope), Claims(output),
+        output_(output), parse_start_(std::chrono::steady_clock::now()) {}
+
+  virtual void Initialize(clang::ASTContext &Context) {
+    SM = &Context.getSourceManager();
+  }
+
+  // Only consulted when the action enables SkipFunctionBodies. Bodies outside
+  // the analysis scope would never be traversed, so they are not parsed
+  // either; their declarations remain available for name lookup.
+  virtual bool shouldSkipFunctionBody(clang::Decl *D) {
+    return !ScopeFilter.Contains(*SM, D->getLocation());
+  }
+
+  virtual void HandleTranslationUnit(clang::ASTContext &Context) {
+    output_.parse_ms += MillisecondsSince(parse_start_);
+    AnalyzeTranslationUnit(profiles_, ScopeFilter, Claims, Context, output_);
+  }
+
+private:
+  const std::vector<AnalysisProfile> &profiles_;
+  const clang::SourceManager *SM = nullptr;
+  FileScopeFilter ScopeFilter;
+  SharedFunctionClaims Claims;
+  TranslationUnitOutput &output_;
+  // The consumer is created once the frontend starts on the translation unit.
+  std::chrono::steady_clock::time_point parse_start_;
+};
+
+class ErrorCheckAction : public clang::ASTFrontendAction {
+public:
+  ErrorCheckAction(const std::vector<AnalysisProfile> &profiles,
+                   const AnalysisScope &scope, TranslationUnitOutput &output)
+      : profiles_(profiles), scope_(scope), output_(output) {}
+
+  virtual std::unique_ptr<clang::ASTConsumer>
+  CreateASTConsumer(clang::CompilerInstance &CI, StringRef) {
+    if (!scope_.IsUnrestricted()) {
+      CI.getFrontendOpts().SkipFunctionBodies = true;
+    }
+    return std::make_unique<ErrorCheckConsumer>(profiles_, scope_, output_);
+  }
+
+private:
+  const std::vector<AnalysisProfile> &profiles_;
+  const AnalysisScope &scope_;
+  TranslationUnitOutput &output_;
+};
+
+#ifndef ERRORCK_PLUGIN
+class ErrorCheckActionFactory : public clang::tooling::FrontendActionFactory {
+public:
+  ErrorCheckActionFactory(const std::vector<AnalysisProfile> &profiles,
+                          const AnalysisScope &scope,
+                          TranslationUnitOutput &output)
+      : profiles_(profiles), scope_(scope), output_(output) {}
+
+  std::unique_ptr<clang::FrontendAction> create() override {
+    return std::make_unique<ErrorCheckAction>(profiles_, scope_, output_);
+  }
+
+private:
+  const std::vector<AnalysisProfile> &profiles_;
+  const AnalysisScope &scope_;
+  TranslationUnitOutput &output_;
+};
+
+// Bounded single-producer, single-consumer queue. Push and Pop only touch the
+// two atomic indices; the mutex and condition variable are only used to park
+// a side that has to wait for the other, which is also what gives the
+// producer backpressure when the consumer falls behind.
+template <typename T> class SpscQueue {
+public:
+  explicit SpscQueue(size_t capacity) : slots_(capacity + 1) {}
+
+  // Blocks while the queue is full.
+  void Push(T value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t next = Advance(tail);
+    Wait([&] { return head_.load() != next; });
+    slots_[tail] = std::move(value);
+    tail_.store(next);
+    Wake();
+  }
+
+  // Blocks while the queue is empty. Returns false once the queue has been
+  // closed and drained.
+  bool Pop(T &out) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    Wait([&] { return tail_.load() != head || closed_.load(); });
+    if (tail_.load() == head) {
+      return false;
+    }
+    out = std::move(slots_[head]);
+    head_.store(Advance(head));
+    Wake();
+    return true;
+  }
+
+  // Called by the producer after its last Push.
+  void Close() {
+    closed_.store(true);
+    Wake();
+  }
+
+private:
+  size_t Advance(size_t index) const { return (index + 1) % slots_.size(); }
+
+  // The waiter count is published before `ready` is rechecked under the lock,
+  // and Wake reads it after publishing its index, so a wakeup is never lost.
+  template <typename Ready> void Wait(Ready ready) {
+    if (ready()) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    waiters_.fetch_add(1);
+    cv_.wait(lock, ready);
+    waiters_.fetch_sub(1);
+  }
+
+  void Wake() {
+    if (waiters_.load() == 0) {
+      return;
+    }
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    cv_.notify_all();
+  }
+
+  std::vector<T> slots_;
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+  std::atomic<bool> closed_{false};
+  std::atomic<unsigned> waiters_{0};
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+// Hands per-translation-unit rows to the profile writers in source path order,
+// no matter which order workers finish in. This keeps parallel runs identical
+// to serial ones (including which duplicate row is kept).
+//
+// The SQLite work happens on a dedicated writer thread, so analysis threads
+// only move a finished translation unit's rows into a queue. When the writer
+// falls behind and the queue fills up, Submit blocks until it catches up.
+class OrderedRowCommitter {
+public:
+  OrderedRowCommitter(const std::vector<std::unique_ptr<SqliteWriter>> &writers,
+                      const SharedFunctionRegistry *shared_registry)
+      : writers_(writers), shared_registry_(shared_registry),
+        batches_(kQueuedTranslationUnits),
+        writer_thread_([this] { WriteBatches(); }) {}
+
+  ~OrderedRowCommitter() { Finish(); }
+
+  // `shared_functions` are the header functions the translation unit claimed.
+  // Rows from ones an earlier translation unit took over are dropped when the
+  // translation unit is committed.
+  void Submit(size_t index, std::vector<CallRecord> rows,
+              std::vector<SharedFunctionKey> shared_functions = {}) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.emplace(index, PendingRows{std::move(rows),
+                                        std::move(shared_functions)});
+    while (true) {
+      auto it = pending_.find(next_index_);
+      if (it == pending_.end()) {
+        return;
+      }
+      PendingRows &pending = it->second;
+      if (shared_registry_) {
+        llvm::erase_if(pending.rows, [&](const CallRecord &record) {
+          return record.shared_function >= 0 &&
+                 !shared_registry_->Owns(
+                     pending.shared_functions[record.shared_function],
+                     next_index_);
+        });
+      }
+      // Holding mutex_ here keeps this the queue's only producer.
+      batches_.Push(std::move(pending.rows));
+      pending_.erase(it);
+      ++next_index_;
+    }
+  }
+
+  // Waits for every queued row to reach its writer. Submit must not be called
+  // afterwards; the writers' own Finish and ok() report any SQLite failure.
+  void Finish() {
+    if (!writer_thread_.joinable()) {
+      return;
+    }
+    batches_.Close();
+    writer_thread_.join();
+  }
+
+private:
+  struct PendingRows {
+    std::vector<CallRecord> rows;
+    std::vector<SharedFunctionKey> shared_functions;
+  };
+
+  // Enough finished translation units to ride out a slow transaction commit
+  // without holding every row of a large run in memory.
+  static constexpr size_t kQueuedTranslationUnits = 64;
+
+  void WriteBatches() {
+    std::vector<CallRecord> batch;
+    while (batches_.Pop(batch)) {
+      // InsertCall is a no-op once a writer has failed, so keep draining
+      // rather than leaving producers blocked on a full queue.
+      for (const CallRecord &record : batch) {
+        writers_[record.profile]->InsertCall(record);
+      }
+    }
+  }
+
+  const std::vector<std::unique_ptr<SqliteWriter>> &writers_;
+  const SharedFunctionRegistry *shared_registry_;
+  std::mutex mutex_;
+  std::unordered_map<size_t, PendingRows> pending_;
+  size_t next_index_ = 0;
+  SpscQueue<std::vector<CallRecord>> batches_;
+  // Declared last so it starts after everything it reads is initialized.
+  std::thread writer_thread_;
+};
+
+// The leading #include lines of `path`, before anything but blank lines and
+// comments, each normalized to `#include <name>` or `#include "name"`.
+static std::vector<std::string> ReadIncludePrefix(const std::string &path) {
+  std::vector<std::string> includes;
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer) {
+    return includes;
+  }
+  llvm::StringRef rest = (*buffer)->getBuffer();
+  bool in_comment = false;
+  while (!rest.empty()) {
+    llvm::StringRef line;
+    std::tie(line, rest) = rest.split('\n');
+    line = line.trim();
+    if (in_comment) {
+      size_t end = line.find("*/");
+      if (end == llvm::StringRef::npos) {
+        continue;
+      }
+      in_comment = false;
+      line = line.drop_front(end + 2).trim();
+    }
+    if (line.consume_front("/*")) {
+      size_t end = line.find("*/");
+      if (end == llvm::StringRef::npos) {
+        in_comment = true;
+        continue;
+      }
+      line = line.drop_front(end + 2).trim();
+    }
+    if (line.empty() || line.starts_with("//")) {
+      continue;
+    }
+    // Anything else, including a macro or conditional that could change what
+    // the includes mean, ends the prefix.
+    if (!line.consume_front("#")) {
+      break;
+    }
+    line = line.ltrim();
+    if (!line.consume_front("include")) {
+      break;
+    }
+    line = line.ltrim();
+    char close = 0;
+    if (line.starts_with("<")) {
+      close = '>';
+    } else if (line.starts_with("\"")) {
+      close = '"';
+    }
+    size_t end = close ? line.find(close, 1) : llvm::StringRef::npos;
+    if (end == llvm::StringRef::npos) {
+      break;
+    }
+    llvm::StringRef trailing = line.drop_front(end + 1).trim();
+    if (!trailing.empty() && !trailing.starts_with("//")) {
+      break;
+    }
+    includes.push_back("#include " + line.take_front(end + 1).str());
+  }
+  return includes;
+}
+
+// A precompiled prefix header ready for one translation unit: the PCH to
+// pass with -include-pch and the files it was built from.
+struct PrefixHeader {
+  std::string pch_path;
+  std::vector<std::string> inputs;
+};
+
+// Writes the PCH to the requested path and lists the files it was built
+// from, so later runs can tell when it is stale.
+class GeneratePrefixHeaderAction : public clang::GeneratePCHAction {
+public:
+  GeneratePrefixHeaderAction(std::string output_path,
+                             std::vector<std::string> &inputs)
+      : output_path_(std::move(output_path)), inputs_(inputs) {}
+
+  bool BeginInvocation(clang::CompilerInstance &CI) override {
+    CI.getFrontendOpts().OutputFile = output_path_;
+    return clang::GeneratePCHAction::BeginInvocation(CI);
+  }
+
+  void EndSourceFileAction() override {
+    clang::SourceManager &sm = getCompilerInstance().getSourceManager();
+    for (auto it = sm.fileinfo_begin(); it != sm.fileinfo_end(); ++it) {
+      llvm::SmallString<256> path(it->first.getName());
+      sm.getFileManager().makeAbsolutePath(path);
+      inputs_.push_back(std::string(path));
+    }
+    clang::GeneratePCHAction::EndSourceFileAction();
+  }
+
+private:
+  std::string output_path_;
+  std::vector<std::string> &inputs_;
+};
+
+class GeneratePrefixHeaderFactory
+    : public clang::tooling::FrontendActionFactory {
+public:
+  GeneratePrefixHeaderFactory(std::string output_path,
+                              std::vector<std::string> &inputs)
+      : output_path_(std::move(output_path)), inputs_(inputs) {}
+
+  std::unique_ptr<clang::FrontendAction> create() override {
+    return std::make_unique<GeneratePrefixHeaderAction>(output_path_,
+                                                        inputs_);
+  }
+
+private:
+  std::string output_path_;
+  std::vector<std::string> &inputs_;
+};
+
+// --pch-cache: precompiled headers for the #include lines translation units
+// start with, shared across translation units and runs. A prefix is keyed by
+// its include lines, the source's directory, the clang version, and the
+// compile command with the source, output, and dependency files removed, so
+// only translation units that would parse the prefix identically share one.
+// Each PCH has a manifest of the files it was built from with their sizes,
+// modification times, and content hashes, and is rebuilt when any of them
+// changed, before clang would reject or silently accept it. A translation unit
+// whose PCH still fails to load is parsed again without it.
+//
+// Building a PCH costs more than parsing the prefix once, so a prefix is only
+// built when at least two translation units of the run share it. A PCH left
+// by an earlier run is reused whenever it is still valid. Each translation
+// unit uses the longest of its prefixes that qualifies.
+class PrefixHeaderCache {
+public:
+  bool Open(const std::string &dir, std::string &error) {
+    llvm::SmallString<256> absolute(dir);
+    if (std::error_code ec = llvm::sys::fs::make_absolute(absolute)) {
+      error = "Failed to resolve " + dir + ": " + ec.message();
+      return false;
+    }
+    if (std::error_code ec = llvm::sys::fs::create_directories(absolute)) {
+      error = "Failed to create " + dir + ": " + ec.message();
+      return false;
+    }
+    dir_ = std::string(absolute);
+    return true;
+  }
+
+  // Counts `path`'s prefixes toward the sharing threshold. Must not run
+  // concurrently with Prepare.
+  void Count(const CompilationDatabase &compilations, const std::string &path,
+             const ArgumentsAdjuster &adjuster) {
+    Plan plan;
+    if (MakePlan(compilations, path, adjuster, plan)) {
+      for (uint64_t key : plan.keys) {
+        ++counts_[key];
+      }
+    }
+  }
+
+  // Finds or builds the prefix header for `path`. Returns false when the
+  // translation unit should be parsed without one.
+  bool Prepare(const CompilationDatabase &compilations,
+               const std::string &path, const ArgumentsAdjuster &adjuster,
+               PrefixHeader &out) {
+    Plan plan;
+    if (!MakePlan(compilations, path, adjuster, plan)) {
+      return false;
+    }
+    for (size_t length = plan.keys.size(); length > 0; --length) {
+      uint64_t key = plan.keys[length - 1];
+      auto count = counts_.find(key);
+      bool shared = count != counts_.end() && count->second > 1;
+      if (!shared && !llvm::sys::fs::exists(FilePath(key, ".pch"))) {
+        continue;
+      }
+      Entry &entry = GetEntry(key);
+      std::lock_guard<std::mutex> lock(entry.mutex);
+      if (!entry.checked) {
+        entry.checked = true;
+        entry.usable = ReadValidManifest(key, entry.header.inputs) ||
+                       (shared && Build(plan, length, key, entry.header));
+        entry.header.pch_path = FilePath(key, ".pch");
+      }
+      if (entry.usable) {
+        out = entry.header;
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  struct Plan {
+    std::string directory;
+    std::string source_directory;
+    CommandLineArguments args;
+    bool cxx = false;
+    std::vector<std::string> includes;
+    // keys[i] identifies the prefix of the first i + 1 includes.
+    std::vector<uint64_t> keys;
+  };
+
+  struct Entry {
+    std::mutex mutex;
+    bool checked = false;
+    bool usable = false;
+    PrefixHeader header;
+  };
+
+  // Translation units with several compile commands, or whose source does
+  // not appear in its command line, are left alone.
+  static bool MakePlan(const CompilationDatabase &compilations,
+                       const std::string &path,
+                       const ArgumentsAdjuster &adjuster, Plan &plan) {
+    std::vector<CompileCommand> commands =
+        compilations.getCompileCommands(path);
+    if (commands.size() != 1) {
+      return false;
+    }
+    const CompileCommand &command = commands[0];
+    CommandLineArguments args = command.CommandLine;
+    if (adjuster) {
+      args = adjuster(args, command.Filename);
+    }
+    // Output and dependency file names differ for every translation unit but
+    // do not change how the prefix parses, and ClangTool drops them anyway.
+    args = getClangStripOutputAdjuster()(args, command.Filename);
+    args = getClangStripDependencyFileAdjuster()(args, command.Filename);
+    auto source = llvm::find(args, command.Filename);
+    if (args.empty() || source == args.end()) {
+      return false;
+    }
+    args.erase(source);
+    llvm::SmallString<256> source_path(command.Filename);
+    llvm::sys::fs::make_absolute(command.Directory, source_path);
+    plan.includes = ReadIncludePrefix(std::string(source_path));
+    if (plan.includes.empty()) {
+      return false;
+    }
+    plan.directory = command.Directory;
+    plan.source_directory =
+        llvm::sys::path::parent_path(source_path).str();
+    llvm::StringRef extension = llvm::sys::path::extension(command.Filename);
+    plan.cxx = llvm::StringRef(args[0]).contains("++") ||
+               (extension != ".c" && extension != ".m");
+    // The compiler name only decides the language, which `cxx` covers.
+    args.erase(args.begin());
+    plan.args = std::move(args);
+
+    // A PCH only loads into the clang that wrote it.
+    std::string description = clang::getClangFullRepositoryVersion();
+    description.push_back('\0');
+    description += plan.directory;
+    description.push_back('\0');
+    description += plan.source_directory;
+    description.push_back('\0');
+    description += plan.cxx ? "c++" : "c";
+    description.push_back('\0');
+    for (const std::string &arg : plan.args) {
+      description += arg;
+      description.push_back('\0');
+    }
+    for (const std::string &include : plan.includes) {
+      description += include;
+      description.push_back('\n');
+      plan.keys.push_back(HashBytes(description));
+    }
+    return true;
+  }
+
+  std::string FilePath(uint64_t key, llvm::StringRef extension) const {
+    llvm::SmallString<256> path(dir_);
+    llvm::sys::path::append(path, llvm::utohexstr(key) + extension);
+    return std::string(path);
+  }
+
+  Entry &GetEntry(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unique_ptr<Entry> &entry = entries_[key];
+    if (!entry) {
+      entry = std::make_unique<Entry>();
+    }
+    return *entry;
+  }
+
+  // Reads the manifest of `key`'s PCH, failing if there is none or any file
+  // it lists changed since the PCH was built.
+  bool ReadValidManifest(uint64_t key, std::vector<std::string> &inputs) {
+    if (!llvm::sys::fs::exists(FilePath(key, ".pch"))) {
+      return false;
+    }
+    auto buffer = llvm::MemoryBuffer::getFile(FilePath(key, ".deps"));
+    if (!buffer) {
+      return false;
+    }
+    inputs.clear();
+    llvm::SmallVector<llvm::StringRef, 64> lines;
+    (*buffer)->getBuffer().split(lines, '\n', -1, /*KeepEmpty=*/false);
+    for (llvm::StringRef line : lines) {
+      auto [size_text, rest] = line.split(' ');
+      auto [time_text, rest_after_time] = rest.split(' ');
+      auto [hash_text, path] = rest_after_time.split(' ');
+      uint64_t size = 0;
+      int64_t time = 0;
+      uint64_t hash = 0;
+      if (size_text.getAsInteger(10, size) ||
+          time_text.getAsInteger(10, time) ||
+          hash_text.getAsInteger(16, hash) || path.empty()) {
+        return false;
+      }
+      ManifestEntry current;
+      if (!ReadManifestEntry(path.str(), current) || current.size != size ||
+          current.time != time || current.hash != hash) {
+        return false;
+      }
+      inputs.push_back(path.str());
+    }
+    return true;
+  }
+
+  // What the manifest records about one input. Clang itself only compares
+  // sizes and whole-second modification times, so the content hash catches
+  // edits that keep both.
+  struct ManifestEntry {
+    uint64_t size = 0;
+    int64_t time = 0;
+    uint64_t hash = 0;
+  };
+
+  static bool ReadManifestEntry(const std::string &path, ManifestEntry &out) {
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(path, status)) {
+      return false;
+    }
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer) {
+      return false;
+    }
+    out.size = status.getSize();
+    out.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   status.getLastModificationTime().time_since_epoch())
+                   .count();
+    out.hash = HashBytes((*buffer)->getBuffer());
+    return true;
+  }
+
+  // Builds the PCH for the first `length` includes of `plan` and records its
+  // manifest. Diagnostics are dropped; the translation unit reports any real
+  // problem when it is parsed without the PCH.
+  bool Build(const Plan &plan, size_t length, uint64_t key,
+             PrefixHeader &header) {
+    std::string header_path = FilePath(key, ".h");
+    std::string contents;
+    for (size_t i = 0; i < length; ++i) {
+      contents += plan.includes[i] + "\n";
+    }
+    // The header is an input of the PCH, so an existing one is never
+    // rewritten: that would change its modification time.
+    if (!llvm::sys::fs::exists(header_path) &&
+        !WriteNewFile(header_path, contents)) {
+      return false;
+    }
+
+    // The header lives in the cache, so quoted includes need the source's
+    // directory searched first, as it is for the translation unit.
+    CommandLineArguments args = {"-iquote", plan.source_directory};
+    args.insert(args.end(), plan.args.begin(), plan.args.end());
+    args.push_back("-x");
+    args.push_back(plan.cxx ? "c++-header" : "c-header");
+    clang::tooling::FixedCompilationDatabase compilations(plan.directory,
+                                                          args);
+    ClangTool Tool(compilations, {header_path},
+                   std::make_shared<clang::PCHContainerOperations>(),
+                   llvm::vfs::createPhysicalFileSystem());
+    clang::IgnoringDiagConsumer diagnostics;
+    Tool.setDiagnosticConsumer(&diagnostics);
+    std::vector<std::string> inputs;
+    GeneratePrefixHeaderFactory factory(FilePath(key, ".pch"), inputs);
+    if (Tool.run(&factory) != 0) {
+      return false;
+    }
+
+    std::string manifest;
+    for (const std::string &input : inputs) {
+      ManifestEntry entry;
+      if (!ReadManifestEntry(input, entry)) {
+        return false;
+      }
+      manifest += std::to_string(entry.size) + " " +
+                  std::to_string(entry.time) + " " +
+                  llvm::utohexstr(entry.hash) + " " + input + "\n";
+    }
+    if (!WriteNewFile(FilePath(key, ".deps"), manifest)) {
+      return false;
+    }
+    header.inputs = std::move(inputs);
+    return true;
+  }
+
+  // Writes `contents` to a temporary file and renames it over `path`, so
+  // other runs sharing the cache never see it half written.
+  static bool WriteNewFile(const std::string &path,
+                           const std::string &contents) {
+    llvm::SmallString<256> temporary;
+    int fd = -1;
+    if (llvm::sys::fs::createUniqueFile(path + ".%%%%%%%%", fd, temporary)) {
+      return false;
+    }
+    {
+      llvm::raw_fd_ostream out(fd, /*shouldClose=*/true);
+      out << contents;
+      if (out.has_error()) {
+        out.clear_error();
+        llvm::sys::fs::remove(temporary);
+        return false;
+      }
+    }
+    if (llvm::sys::fs::rename(temporary, path)) {
+      llvm::sys::fs::remove(temporary);
+      return false;
+    }
+    return true;
+  }
+
+  std::string dir_;
+  // Filled by Count before any Prepare, then only read.
+  std::unordered_map<uint64_t, unsigned> counts_;
+  std::mutex mutex_;
+  std::unordered_map<uint64_t, std::unique_ptr<Entry>> entries_;
+};
+
+// Adds the files a prefix header was built from to a translation unit's
+// recorded inputs, since parsing with the PCH does not read them.
+static void RecordPrefixInputs(const PrefixHeader &header,
+                               TranslationUnitOutput &output) {
+  if (!output.record_inputs) {
+    return;
+  }
+  std::unordered_set<std::string> recorded;
+  for (const InputFile &input : output.inputs) {
+    recorded.insert(input.path);
+  }
+  for (const std::string &path : header.inputs) {
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (buffer && recorded.insert(path).second) {
+      output.inputs.push_back({path, HashBytes((*buffer)->getBuffer())});
+    }
+  }
+}
+
+// Calls `run` with the adjuster to parse `path` with: `adjuster`, plus
+// -include-pch when `prefix_headers` has a prefix header for it, which is
+// returned in `prefix`. The PCH can still fail to load, for example when a
+// header changes while the run is using it, so when `run` fails with it,
+// `prefix` is reset and `run` is called again without it. `run` must discard
+// anything the first call produced. The attempt with the PCH reports no
+// diagnostics, so a fallback does not print them twice.
+static int RunWithPrefixHeader(
+    PrefixHeaderCache *prefix_headers, const CompilationDatabase &compilations,
+    const std::string &path, const ArgumentsAdjuster &adjuster,
+    std::optional<PrefixHeader> &prefix,
+    llvm::function_ref<int(const ArgumentsAdjuster &,
+                           clang::DiagnosticConsumer *)>
+        run) {
+  PrefixHeader header;
+  if (!prefix_headers ||
+      !prefix_headers->Prepare(compilations, path, adjuster, header)) {
+    return run(adjuster, nullptr);
+  }
+  ArgumentsAdjuster with_prefix = combineAdjusters(
+      adjuster, getInsertArgumentAdjuster({"-include-pch", header.pch_path},
+                                          ArgumentInsertPosition::BEGIN));
+  clang::IgnoringDiagConsumer quiet;
+  if (run(with_prefix, &quiet) == 0) {
+    prefix = std::move(header);
+    return 0;
+  }
+  return run(adjuster, nullptr);
+}
+
+// Each translation unit gets its own ClangTool and physical file system so
+// concurrent workers never share a working directory or tool state. This is
+// the same arrangement clang's AllTUsToolExecutor uses.
+// Diagnostics go to `diagnostics` when it is set.
+static int
+RunTranslationUnit(const CompilationDatabase &compilations,
+                   const std::string &path, const ArgumentsAdjuster &adjuster,
+                   FrontendActionFactory &factory,
+                   clang::DiagnosticConsumer *diagnostics = nullptr) {
+  ClangTool Tool(compilations, {path},
+                 std::make_shared<clang::PCHContainerOperations>(),
+                 llvm::vfs::createPhysicalFileSystem());
+  Tool.appendArgumentsAdjuster(adjuster);
+  if (diagnostics) {
+    Tool.setDiagnosticConsumer(diagnostics);
+  }
+  return Tool.run(&factory);
+}
+
+// Callees the compiler calls without their name being written at the call:
+// range-for's begin and end, structured bindings' get, and the coroutine
+// hooks. --prefilter counts these wherever they appear.
+static constexpr const char *kImplicitlyCalledNames[] = {
+    "begin",
+    "end",
+    "get",
+    "await_ready",
+    "await_suspend",
+    "await_resume",
+    "await_transform",
+    "initial_suspend",
+    "final_suspend",
+    "get_return_object",
+    "get_return_object_on_allocation_failure",
+    "return_value",
+    "return_void",
+    "yield_value",
+    "unhandled_exception",
+};
+
+// The identifiers --prefilter looks for. A call to a notable function always
+// has the function's name in the translation unit's tokens, if only in its
+// declaration. `anywhere` holds the names that count in any file and
+// `in_scope` the ones that only count in files the analysis scope keeps,
+// since calls are only reported from declarations in those files.
+struct PrefilterNames {
+  std::vector<std::string> anywhere;
+  std::vector<std::string> in_scope;
+};
+
+// Fails when a profile could report calls the prefilter cannot rule out:
+// profiles without a functions list, and notable functions whose name is not
+// an identifier, such as operators.
+static bool BuildPrefilterNames(const std::vector<AnalysisProfile> &profiles,
+                                PrefilterNames &out, std::string &error) {
+  std::set<std::string> names;
+  for (const AnalysisProfile &profile : profiles) {
+    if (profile.config.analyze_all_non_void ||
+        profile.config.list_non_void_calls) {
+      error = "--prefilter requires every profile to only select "
+              "--notable-functions.";
+      return false;
+    }
+    for (const auto &entry : profile.notable_functions) {
+      names.insert(entry.first);
+    }
+  }
+  for (const std::string &name : names) {
+    bool identifier = !name.empty() && !llvm::isDigit(name[0]) &&
+                      llvm::all_of(name, [](char c) {
+                        return llvm::isAlnum(c) || c == '_';
+                      });
+    if (!identifier) {
+      error = "--prefilter cannot rule out calls to notable function '" +
+              name + "', which is not an identifier.";
+      return false;
+    }
+    if (llvm::is_contained(kImplicitlyCalledNames, name)) {
+      out.anywhere.push_back(name);
+    } else {
+      out.in_scope.push_back(name);
+    }
+  }
+  return true;
+}
+
+// Runs only the preprocessor and stops at the first token naming a notable
+// function. Names are interned up front, so each token costs one pointer
+// lookup rather than a string comparison.
+class NotableIdentifierScanAction : public clang::PreprocessorFrontendAction {
+public:
+  NotableIdentifierScanAction(const PrefilterNames &names,
+                              const AnalysisScope &scope, bool &found)
+      : names_(names), scope_(scope), found_(found) {}
+
+  void ExecuteAction() override {
+    clang::Preprocessor &pp = getCompilerInstance().getPreprocessor();
+    const clang::SourceManager &sm = getCompilerInstance().getSourceManager();
+    llvm::SmallPtrSet<const clang::IdentifierInfo *, 16> anywhere;
+    llvm::SmallPtrSet<const clang::IdentifierInfo *, 16> in_scope;
+    for (const std::string &name : names_.anywhere) {
+      anywhere.insert(pp.getIdentifierInfo(name));
+    }
+    for (const std::string &name : names_.in_scope) {
+      in_scope.insert(pp.getIdentifierInfo(name));
+    }
+    FileScopeFilter scope_filter(scope_);
+    pp.IgnorePragmas();
+    pp.EnterMainSourceFile();
+    clang::Token token;
+    do {
+      pp.Lex(token);
+      const clang::IdentifierInfo *identifier = token.getIdentifierInfo();
+      if (identifier &&
+          (anywhere.count(identifier) ||
+           (in_scope.count(identifier) &&
+            scope_filter.Contains(sm, token.getLocation())))) {
+        found_ = true;
+        return;
+      }
+    } while (token.isNot(clang::tok::eof));
+  }
+
+private:
+  const PrefilterNames &names_;
+  const AnalysisScope &scope_;
+  bool &found_;
+};
+
+class NotableIdentifierScanFactory
+    : public clang::tooling::FrontendActionFactory {
+public:
+  NotableIdentifierScanFactory(const PrefilterNames &names,
+                               const AnalysisScope &scope, bool &found)
+      : names_(names), scope_(scope), found_(found) {}
+
+  std::unique_ptr<clang::FrontendAction> create() override {
+    return std::make_unique<NotableIdentifierScanAction>(names_, scope_,
+                                                         found_);
+  }
+
+private:
+  const PrefilterNames &names_;
+  const AnalysisScope &scope_;
+  bool &found_;
+};
+
+// --prefilter: whether `path` can contain a reported call. Anything that
+// keeps the scan from finishing cleanly counts as yes, so the full parse
+// runs and reports it. Diagnostics are dropped for the same reason.
+static bool MayCallNotableFunctions(const CompilationDatabase &compilations,
+                                    const std::string &path,
+                                    const ArgumentsAdjuster &adjuster,
+                                    const PrefilterNames &names,
+                                    const AnalysisScope &scope) {
+  ClangTool Tool(compilations, {path},
+                 std::make_shared<clang::PCHContainerOperations>(),
+                 llvm::vfs::createPhysicalFileSystem());
+  Tool.appendArgumentsAdjuster(adjuster);
+  clang::IgnoringDiagConsumer diagnostics;
+  Tool.setDiagnosticConsumer(&diagnostics);
+  bool found = false;
+  NotableIdentifierScanFactory factory(names, scope, found);
+  return Tool.run(&factory) != 0 || found;
+}
+
+// The parse stage of --pipeline: builds the ASTs of every compile command for
+// `path` without analyzing them. Returns the tool result RunTranslationUnit
+// would have, counting an AST with errors as a failure.
+static int ParseTranslationUnit(
+    const CompilationDatabase &compilations, const std::string &path,
+    const ArgumentsAdjuster &adjuster,
+    std::vector<std::unique_ptr<clang::ASTUnit>> &asts,
+    clang::DiagnosticConsumer *diagnostics = nullptr) {
+  ClangTool Tool(compilations, {path},
+                 std::make_shared<clang::PCHContainerOperations>(),
+                 llvm::vfs::createPhysicalFileSystem());
+  Tool.appendArgumentsAdjuster(adjuster);
+  if (diagnostics) {
+    Tool.setDiagnosticConsumer(diagnostics);
+  }
+  int result = Tool.buildASTs(asts);
+  for (const std::unique_ptr<clang::ASTUnit> &ast : asts) {
+    if (ast->getDiagnostics().hasErrorOccurred()) {
+      result = 1;
+    }
+  }
+  return result;
+}
+
+// The analysis stage of --pipeline, run on an AST from ParseTranslationUnit.
+static void AnalyzeParsedTranslationUnit(
+    const std::vector<AnalysisProfile> &profiles, const AnalysisScope &scope,
+    clang::ASTUnit &ast, TranslationUnitOutput &output) {
+  FileScopeFilter scope_filter(scope);
+  SharedFunctionClaims claims(output);
+  AnalyzeTranslationUnit(profiles, scope_filter, claims, ast.getASTContext(),
+                         output);
+}
+
+// --ast-file: loads an AST written by `clang -emit-ast` and analyzes it like
+// a parsed one, so no compile command is needed. Returns the tool result,
+// with an AST that fails to load counting as a failure.
+static int AnalyzeAstFile(const std::vector<AnalysisProfile> &profiles,
+                          const AnalysisScope &scope, const std::string &path,
+                          TranslationUnitOutput &output) {
+  auto load_start = std::chrono::steady_clock::now();
+  auto pch_operations = std::make_shared<clang::PCHContainerOperations>();
+  auto diagnostic_options = std::make_shared<clang::DiagnosticOptions>();
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine> diagnostics =
+      clang::CompilerInstance::createDiagnostics(
+          *llvm::vfs::getRealFileSystem(), *diagnostic_options);
+  clang::HeaderSearchOptions header_search_options;
+  std::unique_ptr<clang::ASTUnit> ast = clang::ASTUnit::LoadFromASTFile(
+      path, pch_operations->getRawReader(), clang::ASTUnit::LoadEverything,
+      diagnostic_options, diagnostics, clang::FileSystemOptions(),
+      header_search_options);
+  if (!ast) {
+    llvm::errs() << "Failed to load AST file " << path << "\n";
+    return 1;
+  }
+  output.parse_ms += MillisecondsSince(load_start);
+  AnalyzeParsedTranslationUnit(profiles, scope, *ast, output);
+  return diagnostics->hasErrorOccurred() ? 1 : 0;
+}
+
+// What the parse stage hands to the analysis stage.
+struct ParsedTranslationUnit {
+  size_t index = 0;
+  int result = 0;
+  uint64_t parse_ms = 0;
+  std::optional<PrefixHeader> prefix;
+  std::vector<std::unique_ptr<clang::ASTUnit>> asts;
+};
+
+// ASTs are by far the largest thing in flight, so at most one finished
+// translation unit waits for the analysis stage.
+static constexpr size_t kQueuedParsedTranslationUnits = 1;
+
+// What an --isolate worker hands back: the tool result for its translation
+// unit, plus the rows, (when asked) input files, and timings.
+static bool WriteWorkerOutput(const std::string &path, int result,
+                              const TranslationUnitOutput &output,
+                              std::string &error) {
+  std::error_code ec;
+  llvm::raw_fd_ostream out(path, ec);
+  if (ec) {
+    error = "Failed to write worker output " + path + ": " + ec.message();
+    return false;
+  }
+  out << ToJson(llvm::json::Object{{"result", result},
+                                   {"rows", EncodeRows(output.rows)},
+                                   {"inputs", EncodeInputs(output.inputs)},
+                                   {"parse_ms",
+                                    static_cast<int64_t>(output.parse_ms)},
+                                   {"analysis_ms",
+                                    static_cast<int64_t>(output.analysis_ms)}});
+  out.close();
+  if (out.has_error()) {
+    error = "Failed to write worker output " + path + ": " +
+            out.error().message();
+    out.clear_error();
+    return false;
+  }
+  return true;
+}
+
+static bool ReadWorkerOutput(const std::string &path, int &result,
+                             TranslationUnitOutput &output,
+                             std::string &error) {
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer) {
+    error = "worker exited without writing results";
+    return false;
+  }
+  auto parsed = llvm::json::parse((*buffer)->getBuffer());
+  if (!parsed) {
+    llvm::consumeError(parsed.takeError());
+    error = "worker wrote malformed results";
+    return false;
+  }
+  const llvm::json::Object *object = parsed->getAsObject();
+  std::optional<int64_t> worker_result =
+      object ? object->getInteger("result") : std::nullopt;
+  const llvm::json::Value *rows = object ? object->get("rows") : nullptr;
+  const llvm::json::Value *inputs = object ? object->get("inputs") : nullptr;
+  if (!worker_result || !rows || !inputs || !DecodeRows(*rows, output.rows) ||
+      !DecodeInputs(*inputs, output.inputs)) {
+    error = "worker wrote malformed results";
+    return false;
+  }
+  result = static_cast<int>(*worker_result);
+  output.parse_ms = static_cast<uint64_t>(
+      object->getInteger("parse_ms").value_or(0));
+  output.analysis_ms = static_cast<uint64_t>(
+      object->getInteger("analysis_ms").value_or(0));
+  return true;
+}
+
+// Runs one translation unit in a child errorck, started with the parent's own
+// arguments plus the hidden worker flags. Returns false with the reason in
+// `error` when the worker crashed, was killed for exceeding --tu-timeout or
+// --tu-memory-limit, or left no results; the caller then skips the
+// translation unit.
+static bool RunIsolatedTranslationUnit(const std::string &executable,
+                                       const std::vector<std::string> &args,
+                                       const std::string &path,
+                                       TranslationUnitOutput &output,
+                                       int &result, std::string &error) {
+  llvm::SmallString<128> output_path;
+  if (std::error_code ec = llvm::sys::fs::createTemporaryFile(
+          "errorck-worker", "json", output_path)) {
+    error = "failed to create worker output file: " + ec.message();
+    return false;
+  }
+  std::string output_arg = "--worker-output=" + output_path.str().str();
+  std::string source_arg = "--worker-source=" + path;
+  // Worker flags go first so they stay ahead of any "--" in `args`.
+  std::vector<llvm::StringRef> worker_args = {executable, output_arg,
+                                              source_arg};
+  if (output.record_inputs) {
+    worker_args.push_back("--worker-record-inputs");
+  }
+  worker_args.insert(worker_args.end(), args.begin(), args.end());
+
+  std::string message;
+  bool execution_failed = false;
+  std::optional<llvm::sys::ProcessStatistics> stats;
+  int rc = llvm::sys::ExecuteAndWait(executable, worker_args, std::nullopt,
+                                     {}, TuTimeout, TuMemoryLimit, &message,
+                                     &execution_failed, &stats);
+  bool ok = false;
+  if (execution_failed) {
+    error = "failed to start worker: " + message;
+  } else if (rc < 0) {
+    // Timeouts and fatal signals; an exhausted memory limit shows up as the
+    // allocation failure's abort.
+    error = message.empty() ? "worker crashed" : message;
+  } else {
+    ok = ReadWorkerOutput(output_path.str().str(), result, output, error);
+  }
+  if (ok && stats) {
+    output.peak_memory_kb = stats->PeakMemory;
+  }
+  llvm::sys::fs::remove(output_path);
+  return ok;
+}
+
+// Hashes the compile commands ClangTool will run for `path`, after our
+// adjusters. Any flag, define, include path, or working directory change
+// invalidates the translation unit's cache entry.
+static uint64_t HashCompileCommands(const CompilationDatabase &compilations,
+                                    const std::string &path,
+                                    const ArgumentsAdjuster &adjuster) {
+  std::string description;
+  for (const CompileCommand &command : compilations.getCompileCommands(path)) {
+    CommandLineArguments args = command.CommandLine;
+    if (adjuster) {
+      args = adjuster(args, command.Filename);
+    }
+    description += command.Directory;
+    description.push_back('\0');
+    for (const std::string &arg : args) {
+      description += arg;
+      description.push_back('\0');
+    }
+    description.push_back('\n');
+  }
+  return HashBytes(description);
+}
+
+// Reads the stats the previous run left in the database at `path`. A missing
+// database, or one written before stats were recorded, just has no history.
+static bool
+LoadTranslationUnitStats(const std::string &path,
+                         std::unordered_map<std::string, TranslationUnitStats>
+                             &out,
+                         std::string &error) {
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(path, ec)) {
+    return true;
+  }
+  sqlite3 *db = nullptr;
+  if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) !=
+      SQLITE_OK) {
+    error = "Failed to read translation unit stats from " + path + ": " +
+            (db ? sqlite3_errmsg(db) : "out of memory");
+    sqlite3_close(db);
+    return false;
+  }
+  sqlite3_stmt *stmt = nullptr;
+  if (sqlite3_prepare_v2(db,
+                         "SELECT path, command_hash, peak_memory_kb, "
+                         "parse_ms, analysis_ms FROM translation_unit_stats;",
+                         -1, &stmt, nullptr) == SQLITE_OK) {
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      const unsigned char *source = sqlite3_column_text(stmt, 0);
+      if (!source) {
+        continue;
+      }
+      TranslationUnitStats &stats =
+          out[reinterpret_cast<const char *>(source)];
+      stats.command_hash =
+          static_cast<uint64_t>(sqlite3_column_int64(stmt, 1));
+      stats.peak_memory_kb =
+          static_cast<uint64_t>(sqlite3_column_int64(stmt, 2));
+      stats.parse_ms = static_cast<uint64_t>(sqlite3_column_int64(stmt, 3));
+      stats.analysis_ms =
+          static_cast<uint64_t>(sqlite3_column_int64(stmt, 4));
+    }
+    sqlite3_finalize(stmt);
+  }
+  sqlite3_close(db);
+  return true;
+}
+
+// Assumed for every translation unit when there is no history at all.
+static constexpr uint64_t kDefaultPeakMemoryKb = 512 * 1024;
+
+// Estimates each translation unit's peak memory from the previous run's
+// stats. Translation units without a matching entry, because they are new or
+// their compile commands changed, are assumed to need the median of the ones
+// with history.
+static std::vector<uint64_t> EstimatePeakMemory(
+    const std::vector<std::string> &keys,
+    const std::vector<uint64_t> &command_hashes,
+    const std::unordered_map<std::string, TranslationUnitStats> &history) {
+  std::vector<uint64_t> estimates(keys.size(), 0);
+  std::vector<uint64_t> known;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto it = history.find(keys[i]);
+    if (it != history.end() && it->second.command_hash == command_hashes[i] &&
+        it->second.peak_memory_kb != 0) {
+      estimates[i] = it->second.peak_memory_kb;
+      known.push_back(estimates[i]);
+    }
+  }
+  uint64_t fallback = kDefaultPeakMemoryKb;
+  if (!known.empty()) {
+    auto middle = known.begin() + known.size() / 2;
+    std::nth_element(known.begin(), middle, known.end());
+    fallback = *middle;
+  }
+  for (uint64_t &estimate : estimates) {
+    if (estimate == 0) {
+      estimate = fallback;
+    }
+  }
+  return estimates;
+}
+
+// Sums the sizes of `path` and the files it reaches through quoted includes,
+// resolved next to the including file. Angle-bracket includes mostly name
+// system and library headers that every translation unit pays for alike, so
+// leaving them out barely changes how translation units compare.
+static uint64_t EstimateSourceBytes(const std::string &path) {
+  std::vector<std::string> pending = {path};
+  std::unordered_set<std::string> seen = {path};
+  uint64_t total = 0;
+  while (!pending.empty()) {
+    std::string file = std::move(pending.back());
+    pending.pop_back();
+    auto buffer = llvm::MemoryBuffer::getFile(file);
+    if (!buffer) {
+      continue;
+    }
+    llvm::StringRef text = (*buffer)->getBuffer();
+    total += text.size();
+    llvm::StringRef directory = llvm::sys::path::parent_path(file);
+    while (!text.empty()) {
+      llvm::StringRef line;
+      std::tie(line, text) = text.split('\n');
+      line = line.ltrim();
+      if (!line.consume_front("#")) {
+        continue;
+      }
+      line = line.ltrim();
+      if (!line.consume_front("include")) {
+        continue;
+      }
+      line = line.ltrim();
+      if (!line.consume_front("\"")) {
+        continue;
+      }
+      llvm::SmallString<256> include(directory);
+      llvm::sys::path::append(include, line.take_until([](char c) {
+        return c == '"';
+      }));
+      llvm::sys::path::remove_dots(include, /*remove_dot_dot=*/true);
+      if (seen.insert(std::string(include)).second) {
+        pending.push_back(std::string(include));
+      }
+    }
+  }
+  return total;
+}
+
+// Orders translation units most expensive first, so the ones that set the
+// wall-clock time start while every thread is still busy. The cost is the
+// previous run's parse and analysis time where the stats match. Otherwise it
+// is EstimateSourceBytes, scaled to milliseconds by how long the translation
+// units with history took per byte, or compared as bytes when none have any.
+static std::vector<size_t> OrderByCost(
+    const std::vector<std::string> &keys,
+    const std::vector<uint64_t> &command_hashes,
+    const std::unordered_map<std::string, TranslationUnitStats> &history) {
+  std::vector<double> costs(keys.size(), 0);
+  std::vector<bool> known(keys.size(), false);
+  std::vector<uint64_t> bytes(keys.size(), 0);
+  double known_ms = 0;
+  double known_bytes = 0;
+  bool any_unknown = false;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto it = history.find(keys[i]);
+    if (it != history.end() && it->second.command_hash == command_hashes[i]) {
+      costs[i] = static_cast<double>(it->second.parse_ms +
+                                     it->second.analysis_ms);
+      known[i] = true;
+    } else {
+      any_unknown = true;
+    }
+  }
+  if (any_unknown) {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      bytes[i] = EstimateSourceBytes(keys[i]);
+      if (known[i]) {
+        known_ms += costs[i];
+        known_bytes += static_cast<double>(bytes[i]);
+      }
+    }
+    double ms_per_byte = known_bytes > 0 ? known_ms / known_bytes : 1;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (!known[i]) {
+        costs[i] = static_cast<double>(bytes[i]) * ms_per_byte;
+      }
+    }
+  }
+
+  std::vector<size_t> order(keys.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+  return order;
+}
+
+// Enough threads to fill `budget_kb` with the smallest translation units, but
+// no more than there are hardware threads or translation units. The budget,
+// not the thread count, is what keeps larger ones from running together.
+static unsigned PickMemoryBoundJobs(const std::vector<uint64_t> &estimates,
+                                    uint64_t budget_kb) {
+  if (estimates.empty()) {
+    return 1;
+  }
+  uint64_t smallest = std::max<uint64_t>(
+      *std::min_element(estimates.begin(), estimates.end()), 1);
+  uint64_t jobs = std::max<uint64_t>(budget_kb / smallest, 1);
+  jobs = std::min<uint64_t>(jobs, estimates.size());
+  jobs = std::min<uint64_t>(
+      jobs, llvm::hardware_concurrency().compute_thread_count());
+  return static_cast<unsigned>(jobs);
+}
+
+// Admits translation units while the estimates of those in flight add up to
+// no more than the budget. One that does not fit even alone still runs once
+// nothing else is, rather than never.
+class MemoryBudgetGate {
+public:
+  explicit MemoryBudgetGate(uint64_t budget_kb) : budget_kb_(budget_kb) {}
+
+  void Acquire(uint64_t kb) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&] {
+      return in_flight_kb_ == 0 || in_flight_kb_ + kb <= budget_kb_;
+    });
+    in_flight_kb_ += kb;
+  }
+
+  void Release(uint64_t kb) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      in_flight_kb_ -= kb;
+    }
+    cv_.notify_all();
+  }
+
+private:
+  const uint64_t budget_kb_;
+  uint64_t in_flight_kb_ = 0;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+// The name a path is sharded by: relative to the directory of its first
+// compile command, or as listed when it has none. Unlike the absolute path,
+// this is the same on machines that check the tree out in different places.
+static std::string ShardName(const CompilationDatabase &compilations,
+                             const std::string &path) {
+  std::vector<CompileCommand> commands = compilations.getCompileCommands(path);
+  if (commands.empty() || commands.front().Directory.empty()) {
+    return path;
+  }
+  std::filesystem::path directory =
+      std::filesystem::absolute(commands.front().Directory).lexically_normal();
+  return std::filesystem::absolute(path)
+      .lexically_normal()
+      .lexically_relative(directory)
+      .generic_string();
+}
+
+// Picks the translation units of shard `index` out of `count`. By default a
+// path's shard is chosen by the hash of its ShardName, so the split does not
+// depend on the order paths are listed in or where the tree is checked out.
+// With `by_size`, paths are dealt largest first to the least loaded shard,
+// which evens out the bytes each shard parses. Every shard must be given the
+// same paths so they all compute the same split.
+static std::vector<std::string>
+SelectShard(const CompilationDatabase &compilations,
+            const std::vector<std::string> &paths, unsigned index,
+            unsigned count, bool by_size) {
+  std::vector<std::string> names;
+  for (const std::string &path : paths) {
+    names.push_back(ShardName(compilations, path));
+  }
+
+  std::vector<unsigned> shard_of(paths.size());
+  if (!by_size) {
+    for (size_t i = 0; i < paths.size(); ++i) {
+      shard_of[i] = static_cast<unsigned>(HashBytes(names[i]) % count);
+    }
+  } else {
+    std::vector<uintmax_t> sizes(paths.size(), 0);
+    for (size_t i = 0; i < paths.size(); ++i) {
+      std::error_code ec;
+      uintmax_t size = std::filesystem::file_size(paths[i], ec);
+      sizes[i] = ec ? 0 : size;
+    }
+    std::vector<size_t> order(paths.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      if (sizes[a] != sizes[b]) {
+        return sizes[a] > sizes[b];
+      }
+      return names[a] < names[b];
+    });
+    std::vector<uintmax_t> loads(count, 0);
+    for (size_t i : order) {
+      auto lightest = std::min_element(loads.begin(), loads.end());
+      shard_of[i] = static_cast<unsigned>(lightest - loads.begin());
+      // Count empty files as one byte so they still spread across shards.
+      *lightest += std::max<uintmax_t>(sizes[i], 1);
+    }
+  }
+
+  std::vector<std::string> selected;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (shard_of[i] == index) {
+      selected.push_back(paths[i]);
+    }
+  }
+  return selected;
+}
+
+// Hashes everything besides the sources that determines the rows: the errorck
+// binary itself, the analysis scope, and each profile's selection, watched
+// functions, handlers, and loggers. Unordered sets are sorted first so the
+// hash is stable.
+static bool
+HashAnalysisConfiguration(const char *argv0,
+                          const std::vector<AnalysisProfile> &profiles,
+                          const AnalysisScope &scope, uint64_t &hash,
+                          std::string &error) {
+  std::string executable = llvm::sys::fs::getMainExecutable(
+      argv0, reinterpret_cast<void *>(&HashAnalysisConfiguration));
+  auto binary = llvm::MemoryBuffer::getFile(executable, /*IsText=*/false,
+                                            /*RequiresNullTerminator=*/false);
+  if (!binary) {
+    error = "Failed to read errorck executable for --cache: " + executable;
+    return false;
   }
 
-  const NotableFunctions &notable_functions_;
-  AnalysisConfig analysis_config_;
-  const std::unordered_set<std::string> &handler_functions_;
-  const std::unordered_set<std::string> &logger_functions_;
-  SqliteWriter &writer_;
-  clang::ASTContext *ctx_ = nullptr;
-};
+  std::string description = std::to_string(HashBytes((*binary)->getBuffer()));
+  auto append_sorted = [&description](std::vector<std::string> names) {
+    std::sort(names.begin(), names.end());
+    for (const std::string &name : names) {
+      description += name;
+      description.push_back('\0');
+    }
+    description.push_back('\n');
+  };
+  // Pattern order does not matter, so sorting keeps the hash stable as well.
+  append_sorted(scope.include_patterns);
+  append_sorted(scope.exclude_patterns);
+  description.push_back(scope.skip_system_headers ? '1' : '0');
+  for (const AnalysisProfile &profile : profiles) {
+    description.push_back(profile.config.analyze_all_non_void ? '1' : '0');
+    description.push_back(profile.config.exclude_notable ? '1' : '0');
+    description.push_back(profile.config.list_non_void_calls ? '1' : '0');
+    std::vector<std::string> notable;
+    for (const auto &[name, reporting] : profile.notable_functions) {
+      notable.push_back(
+          name + (reporting == ErrorReportingType::kErrno ? "=errno" : "=rv"));
+    }
+    append_sorted(std::move(notable));
+    append_sorted({profile.handler_functions.begin(),
+                   profile.handler_functions.end()});
+    append_sorted({profile.logger_functions.begin(),
+                   profile.logger_functions.end()});
+  }
+  hash = HashBytes(description);
+  return true;
+}
 
-class ErrorCheckConsumer : public clang::ASTConsumer {
+// Compile commands spooled by errorck-cc, one file per compiled source holding
+// a compile_commands.json entry. Entry names start with the time the compile
+// started, so sorting them gives the build's order. Entries are written under
+// a temporary name and renamed into place, so a listed entry is complete.
+class SpoolCompilationDatabase : public CompilationDatabase {
 public:
-  ErrorCheckConsumer(const NotableFunctions &notable_functions,
-                     const AnalysisConfig &analysis_config,
-                     const std::unordered_set<std::string> &handler_functions,
-                     const std::unordered_set<std::string> &logger_functions,
-                     SqliteWriter &writer)
-      : Visitor(notable_functions, analysis_config, handler_functions,
-                logger_functions, writer) {}
+  explicit SpoolCompilationDatabase(std::string dir) : dir_(std::move(dir)) {}
 
-  virtual void HandleTranslationUnit(clang::ASTContext &Context) {
-    Visitor.SetContext(Context);
-    Visitor.TraverseDecl(Context.getTranslationUnitDecl());
+  // Reads the entries spooled since the last call and appends the sources
+  // they introduce to `added`. A source spooled again keeps its first
+  // command, so it is analyzed once per run.
+  bool Load(std::vector<std::string> &added, std::string &error) {
+    std::vector<std::string> names;
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator it(dir_, ec), end;
+         it != end && !ec; it.increment(ec)) {
+      llvm::StringRef name = llvm::sys::path::filename(it->path());
+      if (name.ends_with(".json") && !name.starts_with(".") &&
+          !seen_.count(name.str())) {
+        names.push_back(name.str());
+      }
+    }
+    if (ec) {
+      error = "Failed to read spool directory " + dir_ + ": " + ec.message();
+      return false;
+    }
+    std::sort(names.begin(), names.end());
+    for (const std::string &name : names) {
+      seen_.insert(name);
+      llvm::SmallString<256> path(dir_);
+      llvm::sys::path::append(path, name);
+      CompileCommand command;
+      if (!ReadEntry(path.str().str(), command)) {
+        error = "Malformed spool entry: " + path.str().str();
+        return false;
+      }
+      if (commands_.emplace(command.Filename, command).second) {
+        added.push_back(command.Filename);
+      }
+    }
+    return true;
   }
 
-private:
-  ErrorCheckVisitor Visitor;
-};
+  // Whether the build has marked the spool complete.
+  bool Finished() const {
+    llvm::SmallString<256> marker(dir_);
+    llvm::sys::path::append(marker, "done");
+    return llvm::sys::fs::exists(marker);
+  }
 
-class ErrorCheckAction : public clang::ASTFrontendAction {
-public:
-  ErrorCheckAction(const NotableFunctions &notable_functions,
-                   const AnalysisConfig &analysis_config,
-                   const std::unordered_set<std::string> &handler_functions,
-                   const std::unordered_set<std::string> &logger_functions,
-                   SqliteWriter &writer)
-      : notable_functions_(notable_functions),
-        analysis_config_(analysis_config),
-        handler_functions_(handler_functions),
-        logger_functions_(logger_functions), writer_(writer) {}
+  std::vector<CompileCommand>
+  getCompileCommands(StringRef FilePath) const override {
+    auto it = commands_.find(FilePath.str());
+    if (it == commands_.end()) {
+      return {};
+    }
+    return {it->second};
+  }
 
-  virtual std::unique_ptr<clang::ASTConsumer>
-  CreateASTConsumer(clang::CompilerInstance &, StringRef) {
-    return std::make_unique<ErrorCheckConsumer>(
-        notable_functions_, analysis_config_, handler_functions_,
-        logger_functions_, writer_);
+  std::vector<std::string> getAllFiles() const override {
+    std::vector<std::string> files;
+    for (const auto &entry : commands_) {
+      files.push_back(entry.first);
+    }
+    return files;
   }
 
 private:
-  const NotableFunctions &notable_functions_;
-  AnalysisConfig analysis_config_;
-  const std::unordered_set<std::string> &handler_functions_;
-  const std::unordered_set<std::string> &logger_functions_;
-  SqliteWriter &writer_;
+  static bool ReadEntry(const std::string &path, CompileCommand &out) {
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer) {
+      return false;
+    }
+    auto parsed = llvm::json::parse((*buffer)->getBuffer());
+    if (!parsed) {
+      llvm::consumeError(parsed.takeError());
+      return false;
+    }
+    const llvm::json::Object *object = parsed->getAsObject();
+    std::optional<llvm::StringRef> directory =
+        object ? object->getString("directory") : std::nullopt;
+    std::optional<llvm::StringRef> file =
+        object ? object->getString("file") : std::nullopt;
+    const llvm::json::Array *arguments =
+        object ? object->getArray("arguments") : nullptr;
+    if (!directory || !file || !arguments) {
+      return false;
+    }
+    std::vector<std::string> command_line;
+    for (const llvm::json::Value &argument : *arguments) {
+      std::optional<llvm::StringRef> text = argument.getAsString();
+      if (!text) {
+        return false;
+      }
+      command_line.push_back(text->str());
+    }
+    out = CompileCommand(*directory, *file, std::move(command_line), "");
+    return true;
+  }
+
+  std::string dir_;
+  std::unordered_set<std::string> seen_;
+  // Only modified between batches, while no analysis is running.
+  std::map<std::string, CompileCommand> commands_;
 };
 
-class ErrorCheckActionFactory : public clang::tooling::FrontendActionFactory {
-public:
-  ErrorCheckActionFactory(
-      const NotableFunctions &notable_functions,
-      const AnalysisConfig &analysis_config,
-      const std::unordered_set<std::string> &handler_functions,
-      const std::unordered_set<std::string> &logger_functions,
-      SqliteWriter &writer)
-      : notable_functions_(notable_functions),
-        analysis_config_(analysis_config),
-        handler_functions_(handler_functions),
-        logger_functions_(logger_functions), writer_(writer) {}
+// How often --spool-follow looks for new entries while the spool is idle.
+static constexpr std::chrono::milliseconds kSpoolPollInterval(500);
 
-  std::unique_ptr<clang::FrontendAction> create() override {
-    return std::make_unique<ErrorCheckAction>(
-        notable_functions_, analysis_config_, handler_functions_,
-        logger_functions_, writer_);
+// Folds per-file results the same way ClangTool::run does for many files:
+// any failure wins over skipped files, which win over success.
+static int CombineToolResults(const std::vector<int> &results) {
+  int combined = 0;
+  for (int result : results) {
+    if (result == 1) {
+      return 1;
+    }
+    if (result != 0) {
+      combined = result;
+    }
   }
-
-private:
-  const NotableFunctions &notable_functions_;
-  AnalysisConfig analysis_config_;
-  const std::unordered_set<std::string> &handler_functions_;
-  const std::unordered_set<std::string> &logger_functions_;
-  SqliteWriter &writer_;
-};
+  return combined;
+}
 
 // The main function just initializes and drives libTooling. Most of the work
 // is done in the various classes defined in this file.
@@ -2250,7 +5304,12 @@ private:
 // or write to anything so we just delegate to our RecursiveASTVisitor, which
 // allows running some code whenever certain AST nodes are visited by clang.
 int main(int argc, const char **argv) {
-  auto pRes = CommonOptionsParser::create(argc, argv, Category);
+  // CommonOptionsParser truncates argc at "--", so keep the full command line
+  // for --isolate workers.
+  const std::vector<std::string> original_args(argv + 1, argv + argc);
+  // Sources are optional on the command line because --spool-dir supplies
+  // them instead.
+  auto pRes = CommonOptionsParser::create(argc, argv, Category, cl::ZeroOrMore);
   if (!pRes) {
     llvm::logAllUnhandledErrors(pRes.takeError(), llvm::errs());
     return EXIT_FAILURE;
@@ -2280,9 +5339,42 @@ int main(int argc, const char **argv) {
     }
   }
 
-  NotableFunctions notable_functions;
-  std::unordered_set<std::string> handler_functions;
-  std::unordered_set<std::string> logger_functions;
+  if (ShardCount == 0 || ShardIndex >= ShardCount) {
+    llvm::errs() << "--shard-index must be less than --shard-count.\n";
+    return EXIT_FAILURE;
+  }
+
+  if ((TuTimeout || TuMemoryLimit) && !Isolate) {
+    llvm::errs() << "--tu-timeout and --tu-memory-limit require --isolate.\n";
+    return EXIT_FAILURE;
+  }
+  if (Isolate && DedupHeaderFunctions) {
+    llvm::errs() << "--dedup-header-functions cannot be combined with "
+                    "--isolate.\n";
+    return EXIT_FAILURE;
+  }
+
+  if (IntraTuJobs == 0) {
+    llvm::errs() << "--intra-tu-jobs must be at least 1.\n";
+    return EXIT_FAILURE;
+  }
+
+  if (Pipeline && (Isolate || MemoryBudget || Jobs != 1)) {
+    llvm::errs() << "--pipeline cannot be combined with --isolate, "
+                    "--memory-budget, or --jobs.\n";
+    return EXIT_FAILURE;
+  }
+
+  if (AggregateExamples && !Aggregate) {
+    llvm::errs() << "--aggregate-examples requires --aggregate.\n";
+    return EXIT_FAILURE;
+  }
+
+  std::vector<AnalysisProfile> profiles(1);
+  profiles[0].config = analysis_config;
+  profiles[0].db_path = DatabasePath;
+  profiles[0].aggregate = Aggregate;
+  profiles[0].aggregate_examples = AggregateExamples;
   std::string error;
   if (NotableFunctionsPath.empty()) {
     if (ExcludeNotableFunctions) {
@@ -2295,45 +5387,127 @@ int main(int argc, const char **argv) {
                       "--all-non-void or --list-non-void-calls is set.\n";
       return EXIT_FAILURE;
     }
-  } else if (!LoadNotableFunctions(NotableFunctionsPath, notable_functions,
-                                   handler_functions, logger_functions,
-                                   error)) {
+  } else if (!LoadNotableFunctions(NotableFunctionsPath,
+                                   profiles[0].notable_functions,
+                                   profiles[0].handler_functions,
+                                   profiles[0].logger_functions, error)) {
     llvm::errs() << error << "\n";
     return EXIT_FAILURE;
   }
 
-  std::vector<std::string> extra_compile_flags;
-  if (!CompileFlagsPath.empty()) {
-    if (!ReadCompileFlagsFile(CompileFlagsPath, extra_compile_flags, error)) {
+  for (const std::string &spec : ExtraProfiles) {
+    AnalysisProfile profile;
+    if (!ParseProfileSpec(spec, profile, error)) {
       llvm::errs() << error << "\n";
       return EXIT_FAILURE;
     }
+    profiles.push_back(std::move(profile));
+  }
+  AssignHandlerGroups(profiles);
+
+  std::unordered_set<std::string> db_paths;
+  for (const AnalysisProfile &profile : profiles) {
+    std::string normalized = std::filesystem::absolute(profile.db_path)
+                                 .lexically_normal()
+                                 .string();
+    if (!db_paths.insert(normalized).second) {
+      llvm::errs() << "Database path used by more than one profile: "
+                   << profile.db_path << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  PrefilterNames prefilter_names;
+  if (Prefilter && !BuildPrefilterNames(profiles, prefilter_names, error)) {
+    llvm::errs() << error << "\n";
+    return EXIT_FAILURE;
   }
 
-  SqliteWriter writer;
-  if (!writer.Open(DatabasePath, OverwriteIfNeeded, error)) {
+  AnalysisScope scope;
+  scope.include_patterns = IncludePaths;
+  scope.exclude_patterns = ExcludePaths;
+  scope.skip_system_headers = SkipSystemHeaders;
+  if (!CompilePathPatterns(scope.include_patterns, "--include-path",
+                           scope.include_paths, error) ||
+      !CompilePathPatterns(scope.exclude_patterns, "--exclude-path",
+                           scope.exclude_paths, error)) {
     llvm::errs() << error << "\n";
     return EXIT_FAILURE;
   }
 
+  std::vector<std::string> extra_compile_flags;
+  if (!CompileFlagsPath.empty()) {
+    if (!ReadCompileFlagsFile(CompileFlagsPath, extra_compile_flags, error)) {
+      llvm::errs() << error << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+
   CommonOptionsParser &OptionsParser = pRes.get();
-  std::vector<std::string> SourcePaths = OptionsParser.getSourcePathList();
-  if (SourcePaths.empty()) {
-    SourcePaths = OptionsParser.getCompilations().getAllFiles();
+  if (!AstFiles.empty()) {
+    if (!OptionsParser.getSourcePathList().empty() || !SpoolDir.empty()) {
+      llvm::errs() << "--ast-file cannot be combined with source paths or "
+                      "--spool-dir.\n";
+      return EXIT_FAILURE;
+    }
+    if (Isolate || Pipeline || Prefilter || !CachePath.empty() ||
+        !PchCachePath.empty()) {
+      llvm::errs() << "--ast-file cannot be combined with --isolate, "
+                      "--pipeline, --prefilter, --cache, or --pch-cache.\n";
+      return EXIT_FAILURE;
+    }
+  }
+  std::unique_ptr<SpoolCompilationDatabase> spool;
+  if (!SpoolDir.empty()) {
+    if (!OptionsParser.getSourcePathList().empty()) {
+      llvm::errs() << "--spool-dir cannot be combined with source paths.\n";
+      return EXIT_FAILURE;
+    }
+    if (SpoolFollow && ShardBySize) {
+      llvm::errs() << "--shard-by-size cannot be combined with "
+                      "--spool-follow.\n";
+      return EXIT_FAILURE;
+    }
+    spool = std::make_unique<SpoolCompilationDatabase>(SpoolDir);
+  } else if (SpoolFollow) {
+    llvm::errs() << "--spool-follow requires --spool-dir.\n";
+    return EXIT_FAILURE;
+  }
+  // Without sources, CommonOptionsParser loads no database, so -p is read
+  // here and every file in its database is analyzed.
+  std::unique_ptr<CompilationDatabase> build_compilations;
+  if (!spool && AstFiles.empty() &&
+      OptionsParser.getSourcePathList().empty()) {
+    auto *build_path = static_cast<cl::opt<std::string> *>(
+        cl::getRegisteredOptions().lookup("p"));
+    if (!build_path || build_path->empty()) {
+      llvm::errs() << "No source paths given; pass sources, -p, --spool-dir, "
+                      "or --ast-file.\n";
+      return EXIT_FAILURE;
+    }
+    build_compilations =
+        CompilationDatabase::autoDetectFromDirectory(*build_path, error);
+    if (!build_compilations) {
+      llvm::errs() << "Error while trying to load a compilation database:\n"
+                   << error << "\n";
+      return EXIT_FAILURE;
+    }
   }
-  ClangTool Tool(OptionsParser.getCompilations(), SourcePaths);
+  // Build the adjuster chain once; every per-file ClangTool reuses it.
+  ArgumentsAdjuster adjuster;
   const std::string ResourceDir = CLANG_RESOURCE_DIR;
   if (!ResourceDir.empty()) {
     // Ensure builtin headers come from the LLVM install, not the host
     // toolchain. This is to prevent the "cannot find stddef.h" errors.
     const std::string ResourceArg = "-resource-dir=" + ResourceDir;
-    Tool.appendArgumentsAdjuster(getInsertArgumentAdjuster(
-        ResourceArg.c_str(), ArgumentInsertPosition::BEGIN));
+    adjuster = combineAdjusters(
+        adjuster, getInsertArgumentAdjuster(ResourceArg.c_str(),
+                                            ArgumentInsertPosition::BEGIN));
   }
   if (!extra_compile_flags.empty()) {
     // Insert extra flags before the source file so they are treated as options
     // even when the compile command terminates options with "--".
-    Tool.appendArgumentsAdjuster(
+    ArgumentsAdjuster extra_flags_adjuster =
         [extra_compile_flags](const CommandLineArguments &args,
                               StringRef filename) {
           CommandLineArguments adjusted = args;
@@ -2348,19 +5522,583 @@ int main(int argc, const char **argv) {
               break;
             }
           }
-          adjusted.insert(
-              adjusted.begin() +
-                  static_cast<CommandLineArguments::difference_type>(insert_at),
-              extra_compile_flags.begin(), extra_compile_flags.end());
+          auto offset =
+              static_cast<CommandLineArguments::difference_type>(insert_at);
+          adjusted.insert(adjusted.begin() + offset,
+                          extra_compile_flags.begin(),
+                          extra_compile_flags.end());
           return adjusted;
+        };
+    adjuster = combineAdjusters(adjuster, extra_flags_adjuster);
+  }
+
+  // AST files need no compile commands, and without sources
+  // CommonOptionsParser has no database at all, so they get an empty one.
+  clang::tooling::FixedCompilationDatabase no_compilations(
+      ".", std::vector<std::string>());
+  const CompilationDatabase *compilation_source = &no_compilations;
+  if (spool) {
+    compilation_source = spool.get();
+  } else if (build_compilations) {
+    compilation_source = build_compilations.get();
+  } else if (AstFiles.empty()) {
+    compilation_source = &OptionsParser.getCompilations();
+  }
+  const CompilationDatabase &compilations = *compilation_source;
+  std::unique_ptr<PrefixHeaderCache> prefix_headers;
+  if (!PchCachePath.empty()) {
+    prefix_headers = std::make_unique<PrefixHeaderCache>();
+    if (!prefix_headers->Open(PchCachePath, error)) {
+      llvm::errs() << error << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+  if (!WorkerOutput.empty()) {
+    std::vector<std::string> spooled;
+    if (spool && !spool->Load(spooled, error)) {
+      llvm::errs() << error << "\n";
+      return EXIT_FAILURE;
+    }
+    TranslationUnitOutput output;
+    output.record_inputs = WorkerRecordInputs;
+    output.intra_tu_jobs = IntraTuJobs;
+    // The parent built any shared prefix header this uses.
+    std::optional<PrefixHeader> prefix;
+    const TranslationUnitOutput initial = output;
+    int result = RunWithPrefixHeader(
+        prefix_headers.get(), compilations, WorkerSource, adjuster, prefix,
+        [&](const ArgumentsAdjuster &worker_adjuster,
+            clang::DiagnosticConsumer *diagnostics) {
+          output = initial;
+          ErrorCheckActionFactory factory(profiles, scope, output);
+          return RunTranslationUnit(compilations, WorkerSource,
+                                    worker_adjuster, factory, diagnostics);
         });
+    if (prefix) {
+      RecordPrefixInputs(*prefix, output);
+    }
+    if (!WriteWorkerOutput(WorkerOutput, result, output, error)) {
+      llvm::errs() << error << "\n";
+      return EXIT_FAILURE;
+    }
+    return result;
   }
-  ErrorCheckActionFactory factory(notable_functions, analysis_config,
-                                  handler_functions, logger_functions, writer);
-  int result = Tool.run(&factory);
-  if (!writer.ok()) {
-    llvm::errs() << writer.error_message() << "\n";
-    return EXIT_FAILURE;
+
+  // Read before the writers reset the primary database.
+  std::unordered_map<std::string, TranslationUnitStats> history;
+  if (!LoadTranslationUnitStats(profiles[0].db_path, history, error)) {
+    llvm::errs() << "warning: " << error << "\n";
   }
-  return result;
+
+  std::vector<std::unique_ptr<SqliteWriter>> writers;
+  for (const AnalysisProfile &profile : profiles) {
+    auto writer = std::make_unique<SqliteWriter>();
+    if (!writer->Open(profile.db_path, OverwriteIfNeeded, SqliteBulkLoad,
+                      error)) {
+      llvm::errs() << error << "\n";
+      return EXIT_FAILURE;
+    }
+    if (profile.aggregate) {
+      writer->SetAggregate(profile.aggregate_examples);
+    }
+    writers.push_back(std::move(writer));
+  }
+
+  std::unique_ptr<ResultCache> cache;
+  if (!CachePath.empty()) {
+    uint64_t config_hash = 0;
+    cache = std::make_unique<ResultCache>();
+    if (!HashAnalysisConfiguration(argv[0], profiles, scope, config_hash,
+                                   error) ||
+        !cache->Open(CachePath, config_hash, error)) {
+      llvm::errs() << error << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::unique_ptr<SharedFunctionRegistry> shared_registry;
+  if (DedupHeaderFunctions) {
+    shared_registry = std::make_unique<SharedFunctionRegistry>();
+  }
+
+  OrderedRowCommitter committer(writers, shared_registry.get());
+  const std::string executable = llvm::sys::fs::getMainExecutable(
+      argv[0], reinterpret_cast<void *>(&RunIsolatedTranslationUnit));
+  // Everything below is indexed like SourcePaths, which --spool-follow keeps
+  // extending between batches.
+  std::vector<std::string> SourcePaths;
+  std::vector<int> results;
+  // Non-empty for translation units --isolate skipped.
+  std::vector<std::string> skip_reasons;
+  // Absolute paths and compile command hashes key both the cache and the
+  // stats.
+  std::vector<std::string> keys;
+  std::vector<uint64_t> command_hashes;
+  std::vector<std::optional<TranslationUnitStats>> stats;
+  std::vector<uint64_t> memory_estimates;
+  // Appends this shard's share of `paths` and returns how many it kept.
+  auto add_sources = [&](std::vector<std::string> paths) {
+    if (ShardCount > 1) {
+      paths = SelectShard(compilations, paths, ShardIndex, ShardCount,
+                          ShardBySize);
+    }
+    size_t begin = SourcePaths.size();
+    for (std::string &path : paths) {
+      keys.push_back(
+          std::filesystem::absolute(path).lexically_normal().string());
+      command_hashes.push_back(
+          HashCompileCommands(compilations, path, adjuster));
+      if (prefix_headers) {
+        prefix_headers->Count(compilations, path, adjuster);
+      }
+      SourcePaths.push_back(std::move(path));
+    }
+    size_t end = SourcePaths.size();
+    results.resize(end, 0);
+    skip_reasons.resize(end);
+    stats.resize(end);
+    if (MemoryBudget) {
+      std::vector<std::string> batch_keys(keys.begin() + begin, keys.end());
+      std::vector<uint64_t> batch_hashes(command_hashes.begin() + begin,
+                                         command_hashes.end());
+      for (uint64_t estimate :
+           EstimatePeakMemory(batch_keys, batch_hashes, history)) {
+        memory_estimates.push_back(estimate);
+      }
+    }
+    return end - begin;
+  };
+
+  if (!AstFiles.empty()) {
+    add_sources(std::vector<std::string>(AstFiles.begin(), AstFiles.end()));
+  } else if (build_compilations) {
+    add_sources(build_compilations->getAllFiles());
+  } else if (!spool) {
+    add_sources(OptionsParser.getSourcePathList());
+  } else if (!SpoolFollow) {
+    std::vector<std::string> spooled;
+    if (!spool->Load(spooled, error)) {
+      llvm::errs() << error << "\n";
+      return EXIT_FAILURE;
+    }
+    add_sources(std::move(spooled));
+  }
+
+  unsigned jobs = Jobs;
+  std::unique_ptr<MemoryBudgetGate> memory_gate;
+  if (MemoryBudget) {
+    uint64_t budget_kb = static_cast<uint64_t>(MemoryBudget) * 1024;
+    memory_gate = std::make_unique<MemoryBudgetGate>(budget_kb);
+    if (Jobs.getNumOccurrences() == 0) {
+      // --spool-follow has no sources yet, so it sizes the pool as if every
+      // thread had a translation unit of the default estimate.
+      std::vector<uint64_t> estimates = memory_estimates;
+      if (SpoolFollow) {
+        estimates.assign(llvm::hardware_concurrency().compute_thread_count(),
+                         kDefaultPeakMemoryKb);
+      }
+      jobs = PickMemoryBoundJobs(estimates, budget_kb);
+    }
+  }
+
+  // Submits the cached rows of translation unit `index`, if it has any.
+  auto replay = [&](size_t index) {
+    if (!cache) {
+      return false;
+    }
+    std::vector<CallRecord> rows;
+    if (!cache->Lookup(keys[index], command_hashes[index], rows)) {
+      return false;
+    }
+    // Nothing was measured, so carry the last measurement forward.
+    auto it = history.find(keys[index]);
+    if (it != history.end() &&
+        it->second.command_hash == command_hashes[index]) {
+      stats[index] = it->second;
+    }
+    committer.Submit(index, std::move(rows));
+    return true;
+  };
+  auto new_output = [&](size_t index) {
+    TranslationUnitOutput output;
+    output.record_inputs = cache != nullptr;
+    output.shared_registry = shared_registry.get();
+    output.index = index;
+    output.intra_tu_jobs = IntraTuJobs;
+    return output;
+  };
+  // Records, caches, and submits an analyzed translation unit whose tool
+  // result is already in `results`.
+  auto complete = [&](size_t index, TranslationUnitOutput &output) {
+    if (output.peak_memory_kb != 0) {
+      stats[index] =
+          TranslationUnitStats{command_hashes[index], output.peak_memory_kb,
+                               output.parse_ms, output.analysis_ms};
+    }
+    // Only clean, complete runs are cached so translation units with errors
+    // are retried and cached rows never depend on other translation units.
+    if (cache && results[index] == 0 && !output.skipped_shared_functions) {
+      cache->Store(keys[index], command_hashes[index], output);
+    }
+    committer.Submit(index, std::move(output.rows),
+                     std::move(output.shared_functions));
+  };
+  // Commits no rows for translation unit `index` when --prefilter shows it
+  // names no notable function. It is neither cached nor given stats, since
+  // it was never parsed.
+  auto prefilter = [&](size_t index) {
+    if (!Prefilter ||
+        MayCallNotableFunctions(compilations, SourcePaths[index], adjuster,
+                                prefilter_names, scope)) {
+      return false;
+    }
+    committer.Submit(index, {});
+    return true;
+  };
+  auto analyze = [&](size_t index) {
+    if (replay(index) || prefilter(index)) {
+      return;
+    }
+    if (memory_gate) {
+      memory_gate->Acquire(memory_estimates[index]);
+    }
+    const std::string &path = SourcePaths[index];
+    TranslationUnitOutput output = new_output(index);
+    if (Isolate) {
+      // Build any shared prefix header here, so workers only load it.
+      PrefixHeader header;
+      if (prefix_headers) {
+        prefix_headers->Prepare(compilations, path, adjuster, header);
+      }
+      std::string reason;
+      if (!RunIsolatedTranslationUnit(executable, original_args, path, output,
+                                      results[index], reason)) {
+        llvm::errs() << "Skipping " << path << ": " << reason << "\n";
+        results[index] = 1;
+        skip_reasons[index] = reason;
+        output.rows.clear();
+      }
+    } else if (!AstFiles.empty()) {
+      results[index] = AnalyzeAstFile(profiles, scope, path, output);
+    } else {
+      std::optional<PrefixHeader> prefix;
+      const TranslationUnitOutput initial = output;
+      results[index] = RunWithPrefixHeader(
+          prefix_headers.get(), compilations, path, adjuster, prefix,
+          [&](const ArgumentsAdjuster &tu_adjuster,
+              clang::DiagnosticConsumer *diagnostics) {
+            output = initial;
+            ErrorCheckActionFactory factory(profiles, scope, output);
+            return RunTranslationUnit(compilations, path, tu_adjuster, factory,
+                                      diagnostics);
+          });
+      if (prefix) {
+        RecordPrefixInputs(*prefix, output);
+      }
+    }
+    if (memory_gate) {
+      memory_gate->Release(memory_estimates[index]);
+    }
+    complete(index, output);
+  };
+
+  // Analyzes translation units [begin, end).
+  auto run_batch = [&](size_t begin, size_t end) {
+    if (Pipeline) {
+      // Three stages: this thread analyzes while `parser` builds the next
+      // translation unit's ASTs and the committer's thread writes rows. Cache
+      // hits never reach the analysis stage.
+      SpscQueue<ParsedTranslationUnit> parsed(kQueuedParsedTranslationUnits);
+      std::thread parser([&] {
+        for (size_t i = begin; i < end; ++i) {
+          if (replay(i) || prefilter(i)) {
+            continue;
+          }
+          ParsedTranslationUnit unit;
+          unit.index = i;
+          auto parse_start = std::chrono::steady_clock::now();
+          unit.result = RunWithPrefixHeader(
+              prefix_headers.get(), compilations, SourcePaths[i], adjuster,
+              unit.prefix,
+              [&](const ArgumentsAdjuster &tu_adjuster,
+                  clang::DiagnosticConsumer *diagnostics) {
+                unit.asts.clear();
+                return ParseTranslationUnit(compilations, SourcePaths[i],
+                                            tu_adjuster, unit.asts,
+                                            diagnostics);
+              });
+          unit.parse_ms = MillisecondsSince(parse_start);
+          parsed.Push(std::move(unit));
+        }
+        parsed.Close();
+      });
+      ParsedTranslationUnit unit;
+      while (parsed.Pop(unit)) {
+        TranslationUnitOutput output = new_output(unit.index);
+        for (const std::unique_ptr<clang::ASTUnit> &ast : unit.asts) {
+          AnalyzeParsedTranslationUnit(profiles, scope, *ast, output);
+        }
+        output.parse_ms = unit.parse_ms;
+        if (unit.prefix) {
+          RecordPrefixInputs(*unit.prefix, output);
+        }
+        results[unit.index] = unit.result;
+        complete(unit.index, output);
+        // Free the ASTs before waiting on the next translation unit.
+        unit = ParsedTranslationUnit();
+      }
+      parser.join();
+    } else if (jobs == 1) {
+      for (size_t i = begin; i < end; ++i) {
+        analyze(i);
+      }
+    } else {
+      // Rows are still committed in source order; only start order changes.
+      llvm::DefaultThreadPool pool(llvm::hardware_concurrency(jobs));
+      std::vector<std::string> batch_keys(keys.begin() + begin,
+                                          keys.begin() + end);
+      std::vector<uint64_t> batch_hashes(command_hashes.begin() + begin,
+                                         command_hashes.begin() + end);
+      for (size_t i : OrderByCost(batch_keys, batch_hashes, history)) {
+        pool.async([&analyze, i, begin] { analyze(begin + i); });
+      }
+      pool.wait();
+    }
+  };
+
+  if (!SpoolFollow) {
+    run_batch(0, SourcePaths.size());
+  } else {
+    // Analyze whatever the build has spooled so far, then look again. The
+    // marker is checked before loading so entries spooled just before it
+    // appeared are still picked up.
+    while (true) {
+      bool finished = spool->Finished();
+      std::vector<std::string> spooled;
+      if (!spool->Load(spooled, error)) {
+        llvm::errs() << error << "\n";
+        committer.Finish();
+        return EXIT_FAILURE;
+      }
+      size_t begin = SourcePaths.size();
+      size_t added = add_sources(std::move(spooled));
+      run_batch(begin, SourcePaths.size());
+      if (finished) {
+        break;
+      }
+      if (added == 0) {
+        std::this_thread::sleep_for(kSpoolPollInterval);
+      }
+    }
+  }
+  committer.Finish();
+  for (size_t i = 0; i < SourcePaths.size(); ++i) {
+    if (skip_reasons[i].empty()) {
+      continue;
+    }
+    for (const auto &writer : writers) {
+      writer->RecordSkipped(SourcePaths[i], skip_reasons[i]);
+    }
+  }
+  for (size_t i = 0; i < SourcePaths.size(); ++i) {
+    if (stats[i]) {
+      writers[0]->RecordStats(keys[i], *stats[i]);
+    }
+  }
+  int result = CombineToolResults(results);
+  if (cache && !cache->ok()) {
+    // A cache write failure only costs future runs a re-parse.
+    llvm::errs() << "warning: " << cache->error_message() << "\n";
+  }
+  bool writers_ok = true;
+  for (const auto &writer : writers) {
+    if (!writer->Finish()) {
+      llvm::errs() << writer->error_message() << "\n";
+      writers_ok = false;
+    }
+  }
+  return writers_ok ? result : EXIT_FAILURE;
+}
+
+#else // ERRORCK_PLUGIN
+
+// Settings shared by every translation unit the plugin sees, parsed from
+// -fplugin-arg-errorck-<name>[=<value>] arguments.
+struct PluginOptions {
+  std::vector<AnalysisProfile> profiles;
+  AnalysisScope scope;
+  std::string out_dir;
+  unsigned intra_tu_jobs = 1;
+};
+
+static bool ParsePluginArgs(const std::vector<std::string> &args,
+                            PluginOptions &out, std::string &error) {
+  AnalysisConfig &config = out.profiles.emplace_back().config;
+  std::string functions_path;
+  for (const std::string &arg : args) {
+    auto [name, value] = llvm::StringRef(arg).split('=');
+    if (name == "out-dir") {
+      out.out_dir = value.str();
+    } else if (name == "notable-functions") {
+      functions_path = value.str();
+    } else if (name == "all-non-void") {
+      config.analyze_all_non_void = true;
+    } else if (name == "exclude-notable-functions") {
+      config.analyze_all_non_void = true;
+      config.exclude_notable = true;
+    } else if (name == "list-non-void-calls") {
+      config.list_non_void_calls = true;
+    } else if (name == "include-path") {
+      out.scope.include_patterns.push_back(value.str());
+    } else if (name == "exclude-path") {
+      out.scope.exclude_patterns.push_back(value.str());
+    } else if (name == "skip-system-headers") {
+      out.scope.skip_system_headers = true;
+    } else if (name == "intra-tu-jobs") {
+      if (value.getAsInteger(10, out.intra_tu_jobs) ||
+          out.intra_tu_jobs == 0) {
+        error = "intra-tu-jobs must be a positive integer";
+        return false;
+      }
+    } else {
+      error = "unknown argument '" + arg + "'";
+      return false;
+    }
+  }
+
+  if (out.out_dir.empty()) {
+    error = "out-dir is required";
+    return false;
+  }
+  if (std::error_code ec = llvm::sys::fs::create_directories(out.out_dir)) {
+    error = "failed to create " + out.out_dir + ": " + ec.message();
+    return false;
+  }
+  if (config.list_non_void_calls &&
+      (config.analyze_all_non_void || !functions_path.empty())) {
+    error = "list-non-void-calls cannot be combined with all-non-void, "
+            "exclude-notable-functions, or notable-functions";
+    return false;
+  }
+  if (functions_path.empty()) {
+    if (config.exclude_notable) {
+      error = "exclude-notable-functions requires notable-functions";
+      return false;
+    }
+    if (!config.analyze_all_non_void && !config.list_non_void_calls) {
+      error = "notable-functions is required unless all-non-void or "
+              "list-non-void-calls is set";
+      return false;
+    }
+  } else if (!LoadNotableFunctions(functions_path,
+                                   out.profiles[0].notable_functions,
+                                   out.profiles[0].handler_functions,
+                                   out.profiles[0].logger_functions, error)) {
+    return false;
+  }
+  AssignHandlerGroups(out.profiles);
+  return CompilePathPatterns(out.scope.include_patterns, "include-path",
+                             out.scope.include_paths, error) &&
+         CompilePathPatterns(out.scope.exclude_patterns, "exclude-path",
+                             out.scope.exclude_paths, error);
 }
+
+// Runs ErrorCheckConsumer on the AST the compile already built, then writes
+// the rows to this translation unit's own database.
+class ErrorCheckPluginConsumer : public clang::ASTConsumer {
+public:
+  ErrorCheckPluginConsumer(std::shared_ptr<const PluginOptions> options,
+                           std::string db_path,
+                           clang::DiagnosticsEngine &diagnostics)
+      : options_(std::move(options)), db_path_(std::move(db_path)),
+        diagnostics_(diagnostics),
+        consumer_(options_->profiles, options_->scope, output_) {
+    output_.intra_tu_jobs = options_->intra_tu_jobs;
+  }
+
+  void Initialize(clang::ASTContext &Context) override {
+    consumer_.Initialize(Context);
+  }
+
+  void HandleTranslationUnit(clang::ASTContext &Context) override {
+    consumer_.HandleTranslationUnit(Context);
+    SqliteWriter writer;
+    std::string error;
+    if (!writer.Open(db_path_, /*overwrite=*/true, /*bulk_load=*/true,
+                     error)) {
+      Report(error);
+      return;
+    }
+    for (const CallRecord &record : output_.rows) {
+      writer.InsertCall(record);
+    }
+    if (!writer.Finish()) {
+      Report(writer.error_message());
+    }
+  }
+
+private:
+  void Report(const std::string &message) {
+    unsigned id = diagnostics_.getCustomDiagID(clang::DiagnosticsEngine::Error,
+                                               "errorck: %0");
+    diagnostics_.Report(id) << message;
+  }
+
+  std::shared_ptr<const PluginOptions> options_;
+  std::string db_path_;
+  clang::DiagnosticsEngine &diagnostics_;
+  // Declared before consumer_, which keeps a reference to it.
+  TranslationUnitOutput output_;
+  ErrorCheckConsumer consumer_;
+};
+
+// Runs after the compile's own action (usually code generation) on the same
+// AST, so the only added cost is the analysis itself. Each translation unit
+// writes <out-dir>/<main file name>-<hash>.sqlite, where the hash covers the
+// main file's absolute path and the compile's output file so the same source
+// built twice with different outputs gets two databases. errorck-merge
+// combines them.
+class ErrorCheckPluginAction : public clang::PluginASTAction {
+public:
+  bool ParseArgs(const clang::CompilerInstance &CI,
+                 const std::vector<std::string> &args) override {
+    auto options = std::make_shared<PluginOptions>();
+    std::string error;
+    if (!ParsePluginArgs(args, *options, error)) {
+      clang::DiagnosticsEngine &diagnostics = CI.getDiagnostics();
+      diagnostics.Report(diagnostics.getCustomDiagID(
+          clang::DiagnosticsEngine::Error, "errorck plugin: %0"))
+          << error;
+      return false;
+    }
+    options_ = std::move(options);
+    return true;
+  }
+
+  std::unique_ptr<clang::ASTConsumer>
+  CreateASTConsumer(clang::CompilerInstance &CI, StringRef InFile) override {
+    llvm::SmallString<256> source(InFile);
+    llvm::sys::fs::make_absolute(source);
+    std::string key = source.str().str();
+    key.push_back('\0');
+    key += CI.getFrontendOpts().OutputFile;
+
+    llvm::SmallString<256> db_path(options_->out_dir);
+    llvm::sys::path::append(
+        db_path, llvm::sys::path::filename(source) + "-" +
+                     llvm::utohexstr(HashBytes(key), /*LowerCase=*/true) +
+                     ".sqlite");
+    return std::make_unique<ErrorCheckPluginConsumer>(
+        options_, db_path.str().str(), CI.getDiagnostics());
+  }
+
+  ActionType getActionType() override { return AddAfterMainAction; }
+
+private:
+  std::shared_ptr<const PluginOptions> options_;
+};
+
+static clang::FrontendPluginRegistry::Add<ErrorCheckPluginAction>
+    RegisterPlugin("errorck", "classify how watched calls handle errors");
+
+#endif // ERRORCK_PLUGIN
@@ -0,0 +1,299 @@
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "schema.h"
+#include "sqlite3.h"
+
+// errorck-merge combines result databases written by separate errorck runs,
+// typically the shards of one --shard-count run, into a single database with
+// the same schema. Rows are deduplicated with the same (name, filename, line,
+// column, handling_type) key errorck uses, keeping the row from the earliest
+// input, so passing shards in index order matches an unsharded run.
+//
+// Each input is merged with set-based INSERT ... SELECT statements ordered by
+// the destination's primary key, so SQLite appends to its B-trees in order
+// instead of seeking once per row.
+
+static bool Exec(sqlite3 *db, const std::string &sql, const std::string &what,
+                 std::string &error) {
+  char *errmsg = nullptr;
+  if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errmsg) != SQLITE_OK) {
+    error = "Failed to " + what + ": " +
+            std::string(errmsg ? errmsg : sqlite3_errmsg(db));
+    sqlite3_free(errmsg);
+    return false;
+  }
+  return true;
+}
+
+static bool QueryInt(sqlite3 *db, const char *sql, int64_t &out,
+                     std::string &error) {
+  sqlite3_stmt *stmt = nullptr;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    error = "Failed to query output: " + std::string(sqlite3_errmsg(db));
+    return false;
+  }
+  bool ok = sqlite3_step(stmt) == SQLITE_ROW;
+  if (ok) {
+    out = sqlite3_column_int64(stmt, 0);
+  } else {
+    error = "Failed to query output: " + std::string(sqlite3_errmsg(db));
+  }
+  sqlite3_finalize(stmt);
+  return ok;
+}
+
+static bool Attach(sqlite3 *db, const std::string &path, std::string &error) {
+  sqlite3_stmt *stmt = nullptr;
+  if (sqlite3_prepare_v2(db, "ATTACH DATABASE ? AS shard;", -1, &stmt,
+                         nullptr) != SQLITE_OK) {
+    error = "Failed to attach " + path + ": " + sqlite3_errmsg(db);
+    return false;
+  }
+  sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_TRANSIENT);
+  bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+  if (!ok) {
+    error = "Failed to attach " + path + ": " + sqlite3_errmsg(db);
+  }
+  sqlite3_finalize(stmt);
+  return ok;
+}
+
+// Copies the attached input's example call sites into main. With
+// `max_examples` set, each count keeps at most that many, preferring those of
+// earlier inputs and, within an input, those its files were first seen with.
+static std::string MergeExamplesSql(unsigned max_examples) {
+  const std::string examples =
+      "    SELECT functions.id AS function_id,"
+      "        examples.handling_type_id AS handling_type_id,"
+      "        files.id AS file_id, examples.line AS line,"
+      "        examples.column AS column,"
+      "        row_number() OVER (PARTITION BY functions.id,"
+      "            examples.handling_type_id ORDER BY examples.file_id,"
+      "            examples.line, examples.column) AS position"
+      "    FROM shard.call_examples AS examples"
+      "    JOIN shard.functions AS shard_functions"
+      "        ON shard_functions.id = examples.function_id"
+      "    JOIN main.functions AS functions"
+      "        ON functions.name = shard_functions.name"
+      "    JOIN shard.files AS shard_files"
+      "        ON shard_files.id = examples.file_id"
+      "    JOIN main.files AS files ON files.path = shard_files.path"
+      "    WHERE NOT EXISTS (SELECT 1 FROM main.call_examples AS kept"
+      "        WHERE kept.function_id = functions.id"
+      "            AND kept.handling_type_id = examples.handling_type_id"
+      "            AND kept.file_id = files.id"
+      "            AND kept.line = examples.line"
+      "            AND kept.column = examples.column)";
+  std::string sql =
+      "INSERT OR IGNORE INTO main.call_examples (function_id,"
+      "        handling_type_id, file_id, line, column)"
+      "    SELECT function_id, handling_type_id, file_id, line, column"
+      "    FROM (" +
+      examples + ") AS ranked";
+  if (max_examples) {
+    sql += "    WHERE position + (SELECT count(*)"
+           "        FROM main.call_examples AS kept"
+           "        WHERE kept.function_id = ranked.function_id"
+           "            AND kept.handling_type_id = ranked.handling_type_id)"
+           "        <= " +
+           std::to_string(max_examples);
+  }
+  return sql + "    ORDER BY function_id, handling_type_id, file_id, line,"
+               "        column;";
+}
+
+// Merges the database attached as `shard` into main. Dimension rows are
+// matched by value, since ids are only meaningful within one database.
+static bool MergeShard(sqlite3 *db, const std::string &path,
+                       unsigned max_examples, std::string &error) {
+  // Continue the commit order of earlier inputs.
+  int64_t id_offset = 0;
+  if (!QueryInt(db, "SELECT coalesce(max(id), 0) FROM main.calls;", id_offset,
+                error)) {
+    return false;
+  }
+
+  const std::string sql =
+      "INSERT OR IGNORE INTO main.handling_types (id, name)"
+      "    SELECT id, name FROM shard.handling_types ORDER BY id;"
+      "INSERT OR IGNORE INTO main.files (path)"
+      "    SELECT path FROM shard.files ORDER BY path;"
+      "INSERT OR IGNORE INTO main.functions (name)"
+      "    SELECT name FROM shard.functions ORDER BY name;"
+      "INSERT OR IGNORE INTO main.calls (file_id, line, column, function_id,"
+      "        handling_type_id, id, assigned_file_id, assigned_line,"
+      "        assigned_column)"
+      "    SELECT files.id, calls.line, calls.column, functions.id,"
+      "        calls.handling_type_id, calls.id + " +
+      std::to_string(id_offset) +
+      ", assigned_files.id, calls.assigned_line, calls.assigned_column"
+      "    FROM shard.calls AS calls"
+      "    JOIN shard.files AS shard_files ON shard_files.id = calls.file_id"
+      "    JOIN main.files AS files ON files.path = shard_files.path"
+      "    JOIN shard.functions AS shard_functions"
+      "        ON shard_functions.id = calls.function_id"
+      "    JOIN main.functions AS functions"
+      "        ON functions.name = shard_functions.name"
+      "    LEFT JOIN shard.files AS shard_assigned"
+      "        ON shard_assigned.id = calls.assigned_file_id"
+      "    LEFT JOIN main.files AS assigned_files"
+      "        ON assigned_files.path = shard_assigned.path"
+      "    ORDER BY files.id, calls.line, calls.column, functions.id,"
+      "        calls.handling_type_id;"
+      // Counts from --aggregate runs are summed. Shards only share call sites
+      // in common headers, which are then counted once per shard.
+      "INSERT INTO main.call_counts (function_id, handling_type_id, count)"
+      "    SELECT functions.id, counts.handling_type_id, counts.count"
+      "    FROM shard.call_counts AS counts"
+      "    JOIN shard.functions AS shard_functions"
+      "        ON shard_functions.id = counts.function_id"
+      "    JOIN main.functions AS functions"
+      "        ON functions.name = shard_functions.name"
+      "    WHERE true"
+      "    ORDER BY functions.id, counts.handling_type_id"
+      "    ON CONFLICT (function_id, handling_type_id)"
+      "        DO UPDATE SET count = count + excluded.count;" +
+      MergeExamplesSql(max_examples) +
+      "INSERT OR IGNORE INTO main.skipped_translation_units (path, reason)"
+      "    SELECT path, reason FROM shard.skipped_translation_units"
+      "    ORDER BY path;"
+      "INSERT OR IGNORE INTO main.translation_unit_stats (path, command_hash,"
+      "        peak_memory_kb, parse_ms, analysis_ms)"
+      "    SELECT path, command_hash, peak_memory_kb, parse_ms, analysis_ms"
+      "    FROM shard.translation_unit_stats ORDER BY path;";
+
+  // ATTACH and DETACH cannot run inside a transaction, so each input gets
+  // its own.
+  if (!Exec(db, "BEGIN;", "begin transaction", error)) {
+    return false;
+  }
+  if (!Exec(db, sql, "merge " + path, error)) {
+    std::string rollback_error;
+    Exec(db, "ROLLBACK;", "roll back", rollback_error);
+    return false;
+  }
+  return Exec(db, "COMMIT;", "commit " + path, error);
+}
+
+static bool ParseCount(const std::string &text, unsigned &out) {
+  if (text.empty() ||
+      text.find_first_not_of("0123456789") != std::string::npos ||
+      text.size() > 9) {
+    return false;
+  }
+  out = static_cast<unsigned>(std::stoul(text));
+  return true;
+}
+
+static void PrintUsage(const char *argv0) {
+  std::cerr << "Usage: " << argv0
+            << " [--overwrite-if-needed] [--aggregate-examples <n>] --db "
+               "<output> <input>...\n";
+}
+
+int main(int argc, char **argv) {
+  std::string output_path;
+  bool overwrite = false;
+  // Matches errorck --aggregate-examples; 0 keeps every example.
+  unsigned max_examples = 0;
+  std::vector<std::string> inputs;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--db" && i + 1 < argc) {
+      output_path = argv[++i];
+    } else if (arg.rfind("--db=", 0) == 0) {
+      output_path = arg.substr(5);
+    } else if (arg == "--aggregate-examples" && i + 1 < argc) {
+      if (!ParseCount(argv[++i], max_examples)) {
+        std::cerr << "Invalid --aggregate-examples: " << argv[i] << "\n";
+        return EXIT_FAILURE;
+      }
+    } else if (arg.rfind("--aggregate-examples=", 0) == 0) {
+      if (!ParseCount(arg.substr(21), max_examples)) {
+        std::cerr << "Invalid " << arg << "\n";
+        return EXIT_FAILURE;
+      }
+    } else if (arg == "--overwrite-if-needed") {
+      overwrite = true;
+    } else if (arg == "--help" || arg == "-h") {
+      PrintUsage(argv[0]);
+      return EXIT_SUCCESS;
+    } else if (arg.rfind("-", 0) == 0) {
+      std::cerr << "Unknown option: " << arg << "\n";
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    } else {
+      inputs.push_back(arg);
+    }
+  }
+  if (output_path.empty() || inputs.empty()) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  std::error_code ec;
+  for (const std::string &input : inputs) {
+    if (!std::filesystem::is_regular_file(input, ec)) {
+      std::cerr << "Input database not found: " << input << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+  if (std::filesystem::exists(output_path, ec)) {
+    if (!overwrite) {
+      std::cerr << "Database already exists: " << output_path << "\n";
+      return EXIT_FAILURE;
+    }
+    if (!std::filesystem::remove(output_path, ec)) {
+      std::cerr << "Failed to remove existing database: " << output_path
+                << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  sqlite3 *db = nullptr;
+  if (sqlite3_open(output_path.c_str(), &db) != SQLITE_OK) {
+    std::cerr << "Failed to open database: "
+              << (db ? sqlite3_errmsg(db) : output_path) << "\n";
+    sqlite3_close(db);
+    return EXIT_FAILURE;
+  }
+
+  // The output is rebuilt from the inputs on every run, so skip durability
+  // just like errorck --sqlite-bulk-load.
+  std::string error;
+  bool ok = Exec(db,
+                 "PRAGMA journal_mode = MEMORY;"
+                 "PRAGMA synchronous = OFF;"
+                 "PRAGMA temp_store = MEMORY;",
+                 "configure output", error) &&
+            Exec(db, kOutputSchemaSql, "initialize schema", error);
+  for (const std::string &input : inputs) {
+    if (!ok) {
+      break;
+    }
+    ok = Attach(db, input, error);
+    if (!ok) {
+      break;
+    }
+    ok = MergeShard(db, input, max_examples, error);
+    std::string detach_error;
+    if (!Exec(db, "DETACH DATABASE shard;", "detach " + input,
+              detach_error) &&
+        ok) {
+      error = detach_error;
+      ok = false;
+    }
+  }
+  sqlite3_close(db);
+
+  if (!ok) {
+    std::cerr << error << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+#ifndef ERRORCK_SCHEMA_H
+#define ERRORCK_SCHEMA_H
+
+// Shared by errorck, which writes result databases, and errorck-merge, which
+// combines them.
+
+// Output schema. Names, paths, and handling types are stored once in
+// dimension tables and referenced by integer id from the `calls` fact table,
+// whose primary key doubles as the uniqueness constraint. The
+// `watched_calls` view presents the rows with the original column names.
+// Aggregated profiles fill `call_counts` and `call_examples` instead of
+// `calls`. `skipped_translation_units` lists sources that --isolate gave up
+// on, so readers can tell which sources the rows do not cover.
+// `translation_unit_stats` records what each translation unit cost, which the
+// next run schedules with: times in milliseconds and peak memory in KiB. The
+// memory is a measured peak resident size only for runs with --isolate; other
+// runs store an unmeasured estimate scaled from the size of the AST.
+static constexpr const char kOutputSchemaSql[] =
+    "CREATE TABLE IF NOT EXISTS files ("
+    "    id INTEGER PRIMARY KEY,"
+    "    path TEXT NOT NULL UNIQUE"
+    ");"
+    "CREATE TABLE IF NOT EXISTS functions ("
+    "    id INTEGER PRIMARY KEY,"
+    "    name TEXT NOT NULL UNIQUE"
+    ");"
+    "CREATE TABLE IF NOT EXISTS handling_types ("
+    "    id INTEGER PRIMARY KEY,"
+    "    name TEXT NOT NULL UNIQUE"
+    ");"
+    "CREATE TABLE IF NOT EXISTS calls ("
+    "    file_id INTEGER NOT NULL REFERENCES files (id),"
+    "    line INTEGER NOT NULL,"
+    "    column INTEGER NOT NULL,"
+    "    function_id INTEGER NOT NULL REFERENCES functions (id),"
+    "    handling_type_id INTEGER NOT NULL REFERENCES handling_types (id),"
+    "    id INTEGER NOT NULL,"
+    "    assigned_file_id INTEGER REFERENCES files (id),"
+    "    assigned_line INTEGER,"
+    "    assigned_column INTEGER,"
+    "    PRIMARY KEY (file_id, line, column, function_id, handling_type_id)"
+    ") WITHOUT ROWID;"
+    "CREATE VIEW IF NOT EXISTS watched_calls AS"
+    "    SELECT calls.id AS id, functions.name AS name,"
+    "        files.path AS filename, calls.line AS line,"
+    "        calls.column AS column, handling_types.name AS handling_type,"
+    "        assigned_files.path AS assigned_filename,"
+    "        calls.assigned_line AS assigned_line,"
+    "        calls.assigned_column AS assigned_column"
+    "    FROM calls"
+    "    JOIN functions ON functions.id = calls.function_id"
+    "    JOIN files ON files.id = calls.file_id"
+    "    JOIN handling_types ON handling_types.id = calls.handling_type_id"
+    "    LEFT JOIN files AS assigned_files"
+    "        ON assigned_files.id = calls.assigned_file_id;"
+    "CREATE TABLE IF NOT EXISTS call_counts ("
+    "    function_id INTEGER NOT NULL REFERENCES functions (id),"
+    "    handling_type_id INTEGER NOT NULL REFERENCES handling_types (id),"
+    "    count INTEGER NOT NULL,"
+    "    PRIMARY KEY (function_id, handling_type_id)"
+    ") WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS call_examples ("
+    "    function_id INTEGER NOT NULL REFERENCES functions (id),"
+    "    handling_type_id INTEGER NOT NULL REFERENCES handling_types (id),"
+    "    file_id INTEGER NOT NULL REFERENCES files (id),"
+    "    line INTEGER NOT NULL,"
+    "    column INTEGER NOT NULL,"
+    "    PRIMARY KEY (function_id, handling_type_id, file_id, line, column)"
+    ") WITHOUT ROWID;"
+    "CREATE VIEW IF NOT EXISTS watched_call_counts AS"
+    "    SELECT functions.name AS name,"
+    "        handling_types.name AS handling_type, call_counts.count AS count"
+    "    FROM call_counts"
+    "    JOIN functions ON functions.id = call_counts.function_id"
+    "    JOIN handling_types"
+    "        ON handling_types.id = call_counts.handling_type_id;"
+    "CREATE VIEW IF NOT EXISTS watched_call_examples AS"
+    "    SELECT functions.name AS name,"
+    "        handling_types.name AS handling_type, files.path AS filename,"
+    "        call_examples.line AS line, call_examples.column AS column"
+    "    FROM call_examples"
+    "    JOIN functions ON functions.id = call_examples.function_id"
+    "    JOIN files ON files.id = call_examples.file_id"
+    "    JOIN handling_types"
+    "        ON handling_types.id = call_examples.handling_type_id;"
+    "CREATE TABLE IF NOT EXISTS skipped_translation_units ("
+    "    path TEXT PRIMARY KEY,"
+    "    reason TEXT NOT NULL"
+    ");"
+    "CREATE TABLE IF NOT EXISTS translation_unit_stats ("
+    "    path TEXT PRIMARY KEY,"
+    "    command_hash INTEGER NOT NULL,"
+    "    peak_memory_kb INTEGER NOT NULL,"
+    "    parse_ms INTEGER NOT NULL,"
+    "    analysis_ms INTEGER NOT NULL"
+    ");";
+
+#endif // ERRORCK_SCHEMA_H
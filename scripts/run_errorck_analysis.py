@@ -56,32 +56,22 @@ def load_compdb_files(compdb_dir: Path) -> set[Path]:
     return files
 
 
-class ErrorckRun(NamedTuple):
+class ReportOutput(NamedTuple):
     name: str
-    cmd: list[str]
     db: Path
     handling: str
     out: Path
 
 
-def run_errorck_jobs(runs: list[ErrorckRun]) -> dict[str, int]:
-    procs: dict[str, subprocess.Popen] = {}
-    for run in runs:
-        print(" ".join(run.cmd), file=sys.stderr)
-        procs[run.name] = subprocess.Popen(run.cmd)
-
-    results: dict[str, int] = {}
-    for run in runs:
-        rc = procs[run.name].wait()
-        if rc == 1:
-            print(
-                f"{run.name} reported analysis errors (exit 1); continuing.",
-                file=sys.stderr,
-            )
-        elif rc != 0:
-            print(f"{run.name} failed with exit code {rc}.", file=sys.stderr)
-        results[run.name] = rc
-    return results
+def run_errorck(cmd: list[str]) -> int:
+    print(" ".join(cmd), file=sys.stderr)
+    rc = subprocess.run(cmd).returncode
+    if rc == 1:
+        print("errorck reported analysis errors (exit 1); continuing.",
+              file=sys.stderr)
+    elif rc != 0:
+        print(f"errorck failed with exit code {rc}.", file=sys.stderr)
+    return rc
 
 
 def write_list_calls(
@@ -207,103 +197,68 @@ def main() -> int:
     if compile_flags:
         extra_errorck_args = ["--compile-flags", str(compile_flags)]
 
-    runs = [
-        ErrorckRun(
+    reports = [
+        ReportOutput(
             name="list-non-void-calls",
-            cmd=[
-                str(errorck),
-                "--list-non-void-calls",
-                "--db",
-                str(all_funcs_db),
-                "--overwrite-if-needed",
-            ]
-            + extra_errorck_args
-            + [
-                "-p",
-                str(compdb_dir),
-            ]
-            + files,
             db=all_funcs_db,
             handling="observed_non_void",
             out=all_funcs_txt,
         ),
-        ErrorckRun(
+        ReportOutput(
             name="all-non-void",
-            cmd=[
-                str(errorck),
-                "--all-non-void",
-                "--db",
-                str(all_report_db),
-                "--overwrite-if-needed",
-            ]
-            + extra_errorck_args
-            + [
-                "-p",
-                str(compdb_dir),
-            ]
-            + files,
             db=all_report_db,
             handling="ignored",
             out=all_ignored_txt,
         ),
-        ErrorckRun(
+        ReportOutput(
             name="notable-functions",
-            cmd=[
-                str(errorck),
-                "--notable-functions",
-                str(notable),
-                "--db",
-                str(notable_db),
-                "--overwrite-if-needed",
-            ]
-            + extra_errorck_args
-            + [
-                "-p",
-                str(compdb_dir),
-            ]
-            + files,
             db=notable_db,
             handling="ignored",
             out=notable_ignored_txt,
         ),
-        ErrorckRun(
+        ReportOutput(
             name="exclude-notable-functions",
-            cmd=[
-                str(errorck),
-                "--exclude-notable-functions",
-                "--notable-functions",
-                str(ignored),
-                "--db",
-                str(report_db),
-                "--overwrite-if-needed",
-            ]
-            + extra_errorck_args
-            + [
-                "-p",
-                str(compdb_dir),
-            ]
-            + files,
             db=report_db,
             handling="ignored",
             out=ignored_txt,
         ),
     ]
 
-    # Run errorck passes in parallel so one problematic file does not stall
-    # the rest of the analysis pipeline.
-    results = run_errorck_jobs(runs)
+    # All four reports come out of a single errorck pass: the listing is the
+    # primary output and the others are extra profiles, so every translation
+    # unit is parsed once instead of four times.
+    cmd = (
+        [
+            str(errorck),
+            "--list-non-void-calls",
+            "--db",
+            str(all_funcs_db),
+            "--profile",
+            f"mode=all-non-void,db={all_report_db}",
+            "--profile",
+            f"mode=notable-functions,db={notable_db},functions={notable}",
+            "--profile",
+            f"mode=exclude-notable-functions,db={report_db},functions={ignored}",
+            "--overwrite-if-needed",
+        ]
+        + extra_errorck_args
+        + [
+            "-p",
+            str(compdb_dir),
+        ]
+        + files
+    )
+    rc = run_errorck(cmd)
+    if rc not in (0, 1):
+        return 1
 
     failed = False
-    for run in runs:
-        rc = results.get(run.name, 1)
-        if rc not in (0, 1):
-            failed = True
-            continue
+    for report in reports:
         if not write_list_calls(
             list_calls,
-            run.db,
-            run.handling,
-            run.out,
+            report.db,
+            report.handling,
+            report.out,
             allow_missing_db=(rc == 1),
         ):
             failed = True
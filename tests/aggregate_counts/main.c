@@ -0,0 +1,8 @@
+#include <stdlib.h>
+
+int main(void) {
+  malloc(1);
+  malloc(2);
+  (void)malloc(3);
+  return 0;
+}
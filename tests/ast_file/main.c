@@ -0,0 +1,13 @@
+#include <stdlib.h>
+
+void *keep(void) { return malloc(1); }
+
+int main(void) {
+  malloc(2);
+  void *p = malloc(3);
+  if (!p) {
+    return 1;
+  }
+  free(p);
+  return keep() != NULL;
+}
@@ -0,0 +1,3 @@
+#include <stdlib.h>
+
+void other(void) { (void)malloc(4); }
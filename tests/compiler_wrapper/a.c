@@ -0,0 +1,4 @@
+#include <stdlib.h>
+#include "header.h"
+
+void a(void) { malloc(SIZE); }
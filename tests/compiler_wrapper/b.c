@@ -0,0 +1,3 @@
+#include <stdlib.h>
+
+void *b(void) { return malloc(2); }
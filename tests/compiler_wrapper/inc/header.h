@@ -0,0 +1 @@
+#define SIZE 4
@@ -0,0 +1,6 @@
+#include "shared.h"
+
+int main(void) {
+  malloc(1);
+  return shared_alloc() == 0;
+}
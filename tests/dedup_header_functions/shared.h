@@ -0,0 +1,10 @@
+#include <stdlib.h>
+
+static void *shared_alloc(void) {
+#ifdef OTHER_TU
+  (void)malloc(8);
+#else
+  malloc(8);
+#endif
+  return malloc(4);
+}
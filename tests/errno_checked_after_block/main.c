@@ -0,0 +1,15 @@
+#include <errno.h>
+#include <stdlib.h>
+
+// The call ends its block; errno is checked by the statement after it.
+int main(int argc, char **argv) {
+  unsigned long x = 0;
+  errno = 0;
+  if (argc > 1) {
+    x = strtoull(argv[1], NULL, 10);
+  }
+  if (errno == ERANGE) {
+    return 1;
+  }
+  return (int)x;
+}
@@ -0,0 +1,6 @@
+#include "vendor.h"
+
+int main(void) {
+  malloc(1);
+  return vendor_alloc() == 0;
+}
@@ -0,0 +1,3 @@
+#include <stdlib.h>
+
+static void *vendor_alloc(void) { malloc(8); return malloc(4); }
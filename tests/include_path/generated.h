@@ -0,0 +1,4 @@
+#include <stdlib.h>
+
+/* Out of scope, so the body is skipped by the parser and never checked. */
+static void *generated_alloc(void) { return malloc(undeclared_size); }
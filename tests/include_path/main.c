@@ -0,0 +1,6 @@
+#include "generated.h"
+
+int main(void) {
+  malloc(1);
+  return generated_alloc() == 0;
+}
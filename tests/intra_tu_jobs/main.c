@@ -0,0 +1,23 @@
+#include <stdlib.h>
+
+static void first(void) { malloc(1); }
+
+static void *second(void) { return malloc(2); }
+
+static void third(void) { (void)malloc(3); }
+
+static int fourth(void) {
+  void *p = malloc(4);
+  if (!p) {
+    return 1;
+  }
+  free(p);
+  return 0;
+}
+
+int main(void) {
+  first();
+  free(second());
+  third();
+  return fourth();
+}
@@ -0,0 +1,24 @@
+#include <stdlib.h>
+
+namespace outer {
+namespace inner {
+
+void *first() { return malloc(5); }
+
+int second() {
+  void *p = malloc(6);
+  if (!p) {
+    return 1;
+  }
+  free(p);
+  return 0;
+}
+
+} // namespace inner
+} // namespace outer
+
+extern "C" {
+void third() { malloc(7); }
+}
+
+extern "C" void fourth() { (void)malloc(8); }
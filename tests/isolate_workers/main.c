@@ -0,0 +1,7 @@
+#include <stdlib.h>
+
+int main(void) {
+  int *x = malloc(10);
+  int *y = x;
+  return 0;
+}
@@ -0,0 +1 @@
+SELECT path, reason != '' FROM skipped_translation_units ORDER BY path;
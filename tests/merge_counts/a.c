@@ -0,0 +1,7 @@
+#include "shared.h"
+
+int main(void) {
+  malloc(1);
+  fopen("a", "r");
+  return shared_alloc() == 0;
+}
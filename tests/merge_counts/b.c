@@ -0,0 +1,12 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+static FILE *open_log(void) { return fopen("log", "r"); }
+void *again(void) { return malloc(3); }
+
+#include "shared.h"
+
+void other(void) {
+  (void)malloc(2);
+  open_log();
+}
@@ -0,0 +1,4 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+static void *shared_alloc(void) { return malloc(4); }
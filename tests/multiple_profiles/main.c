@@ -0,0 +1,10 @@
+int foo(void) { return 1; }
+int bar(void) { return 2; }
+
+int main(void) {
+  foo();
+  if (bar()) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,6 @@
+#include "shared.inc"
+
+int main(void) {
+  malloc(1);
+  return 0;
+}
@@ -0,0 +1,3 @@
+#include "shared.inc"
+
+void other(void) { malloc(2); }
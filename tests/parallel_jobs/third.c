@@ -0,0 +1,3 @@
+#include <stdlib.h>
+
+void third(void) { free(malloc(3)); }
@@ -0,0 +1,7 @@
+#include <stdlib.h>
+#include "shared.h"
+
+int main(void) {
+  malloc(1);
+  return shared_alloc() == 0;
+}
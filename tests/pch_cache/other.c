@@ -0,0 +1,7 @@
+#include <stdlib.h>
+#include "shared.h"
+
+void other(void) {
+  void *p = shared_alloc();
+  (void)malloc(2);
+}
@@ -0,0 +1,6 @@
+#include <stdlib.h>
+
+void *other(void) {
+  void *p = malloc(2);
+  return p;
+}
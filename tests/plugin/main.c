@@ -0,0 +1,12 @@
+#include <stdlib.h>
+
+int main(void) {
+  void *p = malloc(1);
+  if (!p) {
+    return 1;
+  } else {
+    free(p);
+  }
+  malloc(2);
+  return 0;
+}
@@ -0,0 +1,3 @@
+#include <stdlib.h>
+
+void *other(void) { return malloc(3); }
@@ -0,0 +1,10 @@
+#include <stdlib.h>
+
+int main(void) {
+  void *p = malloc(8);
+  if (p == NULL) {
+    return 1;
+  }
+  free(p);
+  return 0;
+}
@@ -0,0 +1,6 @@
+#include <stdlib.h>
+
+/* Parsing this fails, so the run only passes if --prefilter skips it. */
+int other(int value) {
+  return undeclared_helper(abs(value));
+}
@@ -0,0 +1,3 @@
+#include <stdlib.h>
+
+static void *helper(void) { return malloc(4); }
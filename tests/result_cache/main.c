@@ -0,0 +1,8 @@
+#include "helper.h"
+
+int main(void) {
+  malloc(1);
+  int *x = malloc(10);
+  int *other = x;
+  return 0;
+}
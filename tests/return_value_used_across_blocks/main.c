@@ -0,0 +1,27 @@
+#include <stdlib.h>
+
+// The first result is checked after the block that assigns it; the second is
+// checked at the top of the next loop iteration.
+int main(int argc, char **argv) {
+  (void)argv;
+  void *p = NULL;
+  if (argc > 1) {
+    p = malloc(10);
+  }
+  if (!p) {
+    return 1;
+  }
+  free(p);
+
+  void *q = NULL;
+  for (int i = 0; i < argc; i++) {
+    if (q) {
+      free(q);
+    } else {
+      return 1;
+    }
+    q = malloc(10);
+  }
+  free(q);
+  return 0;
+}
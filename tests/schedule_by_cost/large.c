@@ -0,0 +1,12 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void large(size_t size) {
+  char *p = malloc(size);
+  if (!p) {
+    return;
+  }
+  memset(p, 0, size);
+  free(p);
+}
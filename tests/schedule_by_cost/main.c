@@ -0,0 +1,6 @@
+#include <stdlib.h>
+
+int main(void) {
+  malloc(1);
+  return 0;
+}
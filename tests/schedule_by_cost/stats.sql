@@ -0,0 +1,2 @@
+SELECT path, command_hash != 0, parse_ms >= 0, analysis_ms >= 0
+FROM translation_unit_stats ORDER BY path;
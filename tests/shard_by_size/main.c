@@ -0,0 +1,7 @@
+#include <stdlib.h>
+
+/* The larger file, so --shard-by-size deals it to shard 0. */
+int main(void) {
+  malloc(1);
+  return 0;
+}
@@ -0,0 +1,3 @@
+#include <stdlib.h>
+
+void other(void) { malloc(2); }
@@ -0,0 +1,6 @@
+#include <lib.h>
+
+int main(void) {
+  malloc(1);
+  return lib_alloc() == 0;
+}
@@ -0,0 +1,10 @@
+#include <stdlib.h>
+
+int main(void) {
+#ifdef SECOND_COMMAND
+  (void)malloc(2);
+#else
+  malloc(1);
+#endif
+  return 0;
+}
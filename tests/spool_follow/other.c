@@ -0,0 +1,6 @@
+#include <stdlib.h>
+
+void *other(void) {
+  void *p = malloc(4);
+  return p;
+}
@@ -0,0 +1,8 @@
+#include <stdlib.h>
+
+int main(void) {
+  malloc(1);
+  void *p = malloc(2);
+  free(p);
+  return 0;
+}
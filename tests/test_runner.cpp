@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -193,6 +195,60 @@ static std::string NormalizeOutput(const std::string &output,
   return normalized;
 }
 
+static std::string ColumnText(sqlite3_stmt *stmt, int column) {
+  const char *text =
+      reinterpret_cast<const char *>(sqlite3_column_text(stmt, column));
+  return text ? text : "";
+}
+
+// Aggregated profiles (--aggregate) leave watched_calls empty and write
+// counts plus example call sites instead. Both are appended after the rows.
+static bool AppendCountOutput(sqlite3 *db, std::string &result,
+                              std::string &error) {
+  const char *counts_sql =
+      "SELECT name, handling_type, count FROM watched_call_counts "
+      "ORDER BY name, handling_type;";
+  sqlite3_stmt *stmt = nullptr;
+  if (sqlite3_prepare_v2(db, counts_sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    error = "Failed to query counts: " + std::string(sqlite3_errmsg(db));
+    return false;
+  }
+  int rc;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    result += "{\"name\":\"" + ColumnText(stmt, 0) + "\",\"handlingType\":\"" +
+              ColumnText(stmt, 1) + "\",\"count\":\"" +
+              std::to_string(sqlite3_column_int64(stmt, 2)) + "\"}\n";
+  }
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE) {
+    error = "Failed to read counts: " + std::string(sqlite3_errmsg(db));
+    return false;
+  }
+
+  const char *examples_sql =
+      "SELECT name, handling_type, filename, line, column "
+      "FROM watched_call_examples "
+      "ORDER BY name, handling_type, filename, line, column;";
+  if (sqlite3_prepare_v2(db, examples_sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    error = "Failed to query examples: " + std::string(sqlite3_errmsg(db));
+    return false;
+  }
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    result += "{\"name\":\"" + ColumnText(stmt, 0) + "\",\"handlingType\":\"" +
+              ColumnText(stmt, 1) + "\", \"example\": { \"filename\": \"" +
+              ColumnText(stmt, 2) + "\", \"line\": \"" +
+              std::to_string(sqlite3_column_int(stmt, 3)) +
+              "\", \"column\": \"" +
+              std::to_string(sqlite3_column_int(stmt, 4)) + "\" }}\n";
+  }
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE) {
+    error = "Failed to read examples: " + std::string(sqlite3_errmsg(db));
+    return false;
+  }
+  return true;
+}
+
 static bool ReadDatabaseOutput(const fs::path &db_path, std::string &out,
                                std::string &error) {
   sqlite3 *db = nullptr;
@@ -266,7 +322,11 @@ static bool ReadDatabaseOutput(const fs::path &db_path, std::string &out,
   }
 
   sqlite3_finalize(stmt);
+  bool counts_ok = AppendCountOutput(db, result, error);
   sqlite3_close(db);
+  if (!counts_ok) {
+    return false;
+  }
   out = result;
   return true;
 }
@@ -410,6 +470,36 @@ static bool WriteCompileCommands(const fs::path &output_dir,
   return WriteFile(output_path, json.str());
 }
 
+// A spool/ directory holds hand-written --spool-dir entries. They are copied
+// to spool/ in the test build directory with @TEST_DIR@ replaced by the test
+// directory's absolute path, since spooled paths are absolute.
+static bool CopySpool(const fs::path &test_dir,
+                      const fs::path &test_build_dir) {
+  std::error_code ec;
+  fs::path output_dir = test_build_dir / "spool";
+  fs::create_directories(output_dir, ec);
+  if (ec) {
+    return false;
+  }
+  const std::string test_dir_token = "@TEST_DIR@";
+  std::string directory = WeaklyCanonical(test_dir).string();
+  for (const auto &entry : fs::directory_iterator(test_dir / "spool", ec)) {
+    std::string contents;
+    if (!ReadFile(entry.path(), contents)) {
+      return false;
+    }
+    for (size_t pos = contents.find(test_dir_token); pos != std::string::npos;
+         pos = contents.find(test_dir_token, pos)) {
+      contents.replace(pos, test_dir_token.size(), EscapeJson(directory));
+      pos += EscapeJson(directory).size();
+    }
+    if (!WriteFile(output_dir / entry.path().filename(), contents)) {
+      return false;
+    }
+  }
+  return !ec;
+}
+
 static void PrintDiff(const fs::path &expected_path,
                       const fs::path &actual_path) {
   // Keep diff output readable without relying on a shell.
@@ -426,13 +516,446 @@ static void PrintDiff(const fs::path &expected_path,
   }
 }
 
+// Runs the query in `sql_path` against the output database. Each row becomes
+// a line of its columns separated by '|', with absolute paths normalized like
+// filenames in expected.jsonl.
+static bool ReadQueryOutput(const fs::path &db_path, const fs::path &sql_path,
+                            const fs::path &test_dir, std::string &out,
+                            std::string &error) {
+  std::string sql;
+  if (!ReadFile(sql_path, sql)) {
+    error = "Failed to read " + sql_path.string();
+    return false;
+  }
+  sqlite3 *db = nullptr;
+  if (sqlite3_open_v2(db_path.string().c_str(), &db, SQLITE_OPEN_READONLY,
+                      nullptr) != SQLITE_OK) {
+    error = "Failed to open database: " +
+            std::string(db ? sqlite3_errmsg(db) : db_path.string());
+    sqlite3_close(db);
+    return false;
+  }
+  sqlite3_stmt *stmt = nullptr;
+  if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+    error = "Failed to prepare " + sql_path.filename().string() + ": " +
+            sqlite3_errmsg(db);
+    sqlite3_close(db);
+    return false;
+  }
+  int rc;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    for (int column = 0; column < sqlite3_column_count(stmt); ++column) {
+      if (column > 0) {
+        out += "|";
+      }
+      out += NormalizePath(ColumnText(stmt, column), test_dir);
+    }
+    out += "\n";
+  }
+  if (rc != SQLITE_DONE) {
+    error = "Failed to run " + sql_path.filename().string() + ": " +
+            sqlite3_errmsg(db);
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  return rc == SQLITE_DONE;
+}
+
+// Each <name>.sql in the test directory is run against the output database
+// and compared against <name>.expected, for tables expected.jsonl does not
+// cover.
+static bool CompareQueries(const fs::path &test_dir, const fs::path &db_path) {
+  std::error_code ec;
+  std::vector<fs::path> queries;
+  for (const auto &entry : fs::directory_iterator(test_dir, ec)) {
+    if (entry.path().extension() == ".sql") {
+      queries.push_back(entry.path());
+    }
+  }
+  std::sort(queries.begin(), queries.end());
+  for (const fs::path &query : queries) {
+    std::string actual;
+    std::string error;
+    if (!ReadQueryOutput(db_path, query, test_dir, actual, error)) {
+      std::cerr << error << "\n";
+      return false;
+    }
+    fs::path expected_path = fs::path(query).replace_extension(".expected");
+    std::string expected;
+    if (!ReadFile(expected_path, expected)) {
+      std::cerr << "Failed to read " << expected_path << "\n";
+      return false;
+    }
+    if (actual != expected) {
+      fs::path actual_path =
+          db_path.parent_path() / (query.stem().string() + ".actual");
+      WriteFile(actual_path, actual);
+      std::cerr << "FAIL " << test_dir.filename().string() << "\n";
+      PrintDiff(expected_path, actual_path);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool CompareDatabaseOutput(const fs::path &test_dir,
+                                  const fs::path &db_path,
+                                  const fs::path &expected_path,
+                                  const fs::path &actual_path) {
+  std::string db_output;
+  std::string db_error;
+  if (!ReadDatabaseOutput(db_path, db_output, db_error)) {
+    std::cerr << "Failed to read database output for " << test_dir << "\n";
+    if (!db_error.empty()) {
+      std::cerr << db_error << "\n";
+    }
+    return false;
+  }
+
+  std::string normalized = NormalizeOutput(db_output, test_dir);
+  EnsureTrailingNewline(normalized);
+
+  std::string expected;
+  if (!ReadFile(expected_path, expected)) {
+    std::cerr << "Failed to read expected output for " << test_dir << "\n";
+    return false;
+  }
+  EnsureTrailingNewline(expected);
+
+  if (normalized != expected) {
+    if (!WriteFile(actual_path, normalized)) {
+      std::cerr << "Failed to write actual output for " << test_dir << "\n";
+      return false;
+    }
+
+    std::cerr << "FAIL " << test_dir.filename().string() << "\n";
+    PrintDiff(expected_path, actual_path);
+    return false;
+  }
+  return true;
+}
+
+// Appends `args` to `command`, replacing @BUILD_DIR@ with the test build
+// directory.
+static void AppendArgs(const std::vector<std::string> &args,
+                       const fs::path &test_build_dir,
+                       std::vector<std::string> &command) {
+  const std::string build_dir_token = "@BUILD_DIR@";
+  for (auto arg : args) {
+    for (size_t pos = arg.find(build_dir_token); pos != std::string::npos;
+         pos = arg.find(build_dir_token, pos)) {
+      arg.replace(pos, build_dir_token.size(), test_build_dir.string());
+      pos += test_build_dir.string().size();
+    }
+    command.push_back(arg);
+  }
+}
+
+// `expected_exit` is the exit status the command must return.
+static bool RunSucceeded(const std::vector<std::string> &command,
+                         const fs::path &test_dir, int expected_exit = 0) {
+  CommandResult result = RunCommand(command);
+  if (result.exit_code == expected_exit) {
+    return true;
+  }
+  std::cerr << fs::path(command[0]).filename().string() << " failed for "
+            << test_dir << " (exit " << result.exit_code << ")\n";
+  if (!result.stdout_output.empty()) {
+    std::cerr << result.stdout_output;
+  }
+  if (!result.stderr_output.empty()) {
+    std::cerr << result.stderr_output;
+  }
+  return false;
+}
+
+// cc_commands.txt runs errorck-cc once per line, with the line's words as its
+// arguments, from the test directory and with ERRORCK_SPOOL_DIR set to spool/
+// in the test build directory. errorck then reads that spool.
+// expected_spool_entries.txt holds the number of entries the runs must leave
+// there; none may be a temporary file that was never renamed into place.
+static bool RunCompilerWrapper(const fs::path &cc_path,
+                               const fs::path &test_dir,
+                               const fs::path &test_build_dir) {
+  // Both are used from inside the test directory.
+  fs::path spool_dir = fs::absolute(test_build_dir / "spool");
+  fs::path cc = fs::absolute(cc_path);
+#ifdef _WIN32
+  _putenv_s("ERRORCK_SPOOL_DIR", spool_dir.string().c_str());
+#else
+  setenv("ERRORCK_SPOOL_DIR", spool_dir.string().c_str(), 1);
+#endif
+  // errorck-cc records its working directory, which relative sources and
+  // include paths in the commands are resolved against.
+  std::error_code ec;
+  fs::path original_dir = fs::current_path(ec);
+  fs::current_path(test_dir, ec);
+  if (ec) {
+    std::cerr << "Failed to enter " << test_dir << "\n";
+    return false;
+  }
+  bool ran = true;
+  for (const std::string &line :
+       ReadErrorckArgs(test_dir / "cc_commands.txt")) {
+    std::vector<std::string> command = {cc.string()};
+    std::istringstream words(line);
+    std::string word;
+    while (words >> word) {
+      command.push_back(word);
+    }
+    if (!RunSucceeded(command, test_dir)) {
+      ran = false;
+      break;
+    }
+  }
+  fs::current_path(original_dir, ec);
+#ifdef _WIN32
+  _putenv_s("ERRORCK_SPOOL_DIR", "");
+#else
+  unsetenv("ERRORCK_SPOOL_DIR");
+#endif
+  if (!ran) {
+    return false;
+  }
+
+  fs::path count_path = test_dir / "expected_spool_entries.txt";
+  if (!fs::exists(count_path, ec)) {
+    return true;
+  }
+  std::string text;
+  if (!ReadFile(count_path, text)) {
+    std::cerr << "Failed to read " << count_path << "\n";
+    return false;
+  }
+  size_t expected = static_cast<size_t>(std::atoi(Trim(text).c_str()));
+  size_t entries = 0;
+  bool temporary = false;
+  for (const auto &entry : fs::directory_iterator(spool_dir, ec)) {
+    if (entry.path().filename().string().front() == '.') {
+      temporary = true;
+    } else if (entry.path().extension() == ".json") {
+      ++entries;
+    }
+  }
+  if (entries != expected || temporary) {
+    std::cerr << "FAIL " << test_dir.filename().string() << ": errorck-cc "
+              << "spooled " << entries << " entries, expected " << expected
+              << (temporary ? ", and left a temporary file" : "") << "\n";
+    return false;
+  }
+  return true;
+}
+
+// ast_files.txt lists sources to compile with `clang -emit-ast`, using the
+// test's compile flags. errorck then reads those ASTs through --ast-file
+// instead of parsing the sources itself.
+static bool EmitAsts(const fs::path &clang_path, const fs::path &test_dir,
+                     const fs::path &test_build_dir,
+                     const std::vector<std::string> &flags,
+                     std::vector<std::string> &ast_args) {
+  if (clang_path.empty()) {
+    std::cerr << "--clang is required for " << test_dir << "\n";
+    return false;
+  }
+  for (const std::string &source :
+       ReadErrorckArgs(test_dir / "ast_files.txt")) {
+    fs::path ast_path =
+        test_build_dir / fs::path(source).filename().replace_extension(".ast");
+    std::vector<std::string> command = {clang_path.string(), "-emit-ast"};
+    command.insert(command.end(), flags.begin(), flags.end());
+    command.push_back("-o");
+    command.push_back(ast_path.string());
+    command.push_back(WeaklyCanonical(test_dir / source).string());
+    if (!RunSucceeded(command, test_dir)) {
+      return false;
+    }
+    ast_args.push_back("--ast-file");
+    ast_args.push_back(ast_path.string());
+  }
+  return true;
+}
+
+// merge_inputs.txt runs errorck once per line, over the sources that line
+// lists, and merges the databases with errorck-merge in line order. The
+// merged database is what gets compared. merge_args.txt adds arguments to
+// errorck-merge.
+static bool RunMerged(const std::vector<std::string> &command,
+                      const fs::path &test_dir, const fs::path &test_build_dir,
+                      const fs::path &merge_path, const fs::path &db_path) {
+  std::vector<std::string> merge = {merge_path.string(),
+                                    "--overwrite-if-needed", "--db",
+                                    db_path.string()};
+  std::error_code ec;
+  fs::path merge_args_path = test_dir / "merge_args.txt";
+  if (fs::exists(merge_args_path, ec)) {
+    AppendArgs(ReadErrorckArgs(merge_args_path), test_build_dir, merge);
+  }
+  std::vector<std::string> lines =
+      ReadErrorckArgs(test_dir / "merge_inputs.txt");
+  for (size_t i = 0; i < lines.size(); ++i) {
+    fs::path input_db = test_build_dir / ("input" + std::to_string(i) +
+                                          ".sqlite");
+    std::vector<std::string> input_command = command;
+    // Replace the --db value.
+    input_command[2] = input_db.string();
+    std::istringstream sources(lines[i]);
+    std::string source;
+    while (sources >> source) {
+      input_command.push_back((test_dir / source).string());
+    }
+    if (!RunSucceeded(input_command, test_dir)) {
+      return false;
+    }
+    merge.push_back(input_db.string());
+  }
+  return RunSucceeded(merge, test_dir);
+}
+
+// plugin_sources.txt lists sources to compile with clang and errorck-plugin,
+// using the test's compile flags and functions.json. The databases the plugin
+// writes, one per translation unit, are merged with errorck-merge in name
+// order, and the merged database is what gets compared.
+static bool RunPlugin(const fs::path &clang_path, const fs::path &plugin_path,
+                      const fs::path &merge_path, const fs::path &test_dir,
+                      const fs::path &test_build_dir,
+                      const std::vector<std::string> &flags,
+                      const fs::path &notable_path, const fs::path &db_path) {
+  if (clang_path.empty()) {
+    std::cerr << "--clang is required for " << test_dir << "\n";
+    return false;
+  }
+  fs::path out_dir = test_build_dir / "plugin";
+  for (const std::string &source :
+       ReadErrorckArgs(test_dir / "plugin_sources.txt")) {
+    fs::path object_path =
+        test_build_dir / fs::path(source).filename().replace_extension(".o");
+    std::vector<std::string> command = {clang_path.string()};
+    command.insert(command.end(), flags.begin(), flags.end());
+    command.push_back("-fplugin=" + plugin_path.string());
+    command.push_back("-fplugin-arg-errorck-out-dir=" + out_dir.string());
+    command.push_back("-fplugin-arg-errorck-notable-functions=" +
+                      notable_path.string());
+    command.push_back("-c");
+    command.push_back(WeaklyCanonical(test_dir / source).string());
+    command.push_back("-o");
+    command.push_back(object_path.string());
+    if (!RunSucceeded(command, test_dir)) {
+      return false;
+    }
+  }
+
+  std::vector<std::string> databases;
+  std::error_code ec;
+  for (const auto &entry : fs::directory_iterator(out_dir, ec)) {
+    if (entry.path().extension() == ".sqlite") {
+      databases.push_back(entry.path().string());
+    }
+  }
+  std::sort(databases.begin(), databases.end());
+  std::vector<std::string> merge = {merge_path.string(),
+                                    "--overwrite-if-needed", "--db",
+                                    db_path.string()};
+  merge.insert(merge.end(), databases.begin(), databases.end());
+  return RunSucceeded(merge, test_dir);
+}
+
+// Runs errorck and compares its database, and any extra --profile databases,
+// against the expected output.
+static bool RunAndCompare(const std::vector<std::string> &command,
+                          const fs::path &test_dir,
+                          const fs::path &test_build_dir,
+                          const fs::path &db_path,
+                          const fs::path &expected_path, int expected_exit) {
+  if (!RunSucceeded(command, test_dir, expected_exit)) {
+    return false;
+  }
+
+  if (!CompareDatabaseOutput(test_dir, db_path, expected_path,
+                             test_build_dir / "actual.jsonl")) {
+    return false;
+  }
+
+  if (!CompareQueries(test_dir, db_path)) {
+    return false;
+  }
+
+  // Extra --profile databases are written to <name>.sqlite in the test build
+  // directory and compared against expected.<name>.jsonl.
+  std::error_code ec;
+  std::vector<fs::path> profile_expectations;
+  for (const auto &entry : fs::directory_iterator(test_dir, ec)) {
+    std::string filename = entry.path().filename().string();
+    if (filename != "expected.jsonl" && filename.rfind("expected.", 0) == 0 &&
+        entry.path().extension() == ".jsonl") {
+      profile_expectations.push_back(entry.path());
+    }
+  }
+  std::sort(profile_expectations.begin(), profile_expectations.end());
+  for (const auto &profile_expected : profile_expectations) {
+    std::string name = profile_expected.stem().string().substr(
+        std::string("expected.").size());
+    fs::path profile_db = test_build_dir / (name + ".sqlite");
+    fs::path profile_actual = test_build_dir / ("actual." + name + ".jsonl");
+    if (!CompareDatabaseOutput(test_dir, profile_db, profile_expected,
+                               profile_actual)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// expected_files.txt lists files the run must leave in the test build
+// directory, relative to it. A `*` in the last path component matches any run
+// of characters.
+static bool CheckExpectedFiles(const fs::path &test_dir,
+                               const fs::path &test_build_dir,
+                               const fs::path &list_path) {
+  for (const std::string &line : ReadErrorckArgs(list_path)) {
+    fs::path pattern = test_build_dir / line;
+    std::string name = pattern.filename().string();
+    size_t star = name.find('*');
+    bool found = false;
+    std::error_code ec;
+    if (star == std::string::npos) {
+      found = fs::exists(pattern, ec);
+    } else {
+      std::string prefix = name.substr(0, star);
+      std::string suffix = name.substr(star + 1);
+      for (const auto &entry :
+           fs::directory_iterator(pattern.parent_path(), ec)) {
+        std::string candidate = entry.path().filename().string();
+        if (candidate.size() >= prefix.size() + suffix.size() &&
+            candidate.compare(0, prefix.size(), prefix) == 0 &&
+            candidate.compare(candidate.size() - suffix.size(),
+                              suffix.size(), suffix) == 0) {
+          found = true;
+          break;
+        }
+      }
+    }
+    if (!found) {
+      std::cerr << "FAIL " << test_dir.filename().string() << ": expected "
+                << line << " in " << test_build_dir << "\n";
+      return false;
+    }
+  }
+  return true;
+}
+
 static void PrintUsage(const char *argv0) {
-  std::cerr << "Usage: " << argv0 << " --build-dir <path> --test-dir <path>\n";
+  std::cerr << "Usage: " << argv0
+            << " --build-dir <path> --test-dir <path> [--clang <path>]"
+               " [--plugin <path>]\n";
 }
 
 int main(int argc, char **argv) {
   fs::path build_dir;
   fs::path test_dir;
+  // The clang errorck was built against, for tests that start from its
+  // output.
+  fs::path clang_path;
+  // errorck-plugin, when it is built.
+  fs::path plugin_path;
 
   for (int i = 1; i < argc; ++i) {
     std::string arg = argv[i];
@@ -440,6 +963,10 @@ int main(int argc, char **argv) {
       build_dir = argv[++i];
     } else if (arg == "--test-dir" && i + 1 < argc) {
       test_dir = argv[++i];
+    } else if (arg == "--clang" && i + 1 < argc) {
+      clang_path = argv[++i];
+    } else if (arg == "--plugin" && i + 1 < argc) {
+      plugin_path = argv[++i];
     } else if (arg == "--help" || arg == "-h") {
       PrintUsage(argv[0]);
       return 0;
@@ -553,7 +1080,10 @@ int main(int argc, char **argv) {
       return 1;
     }
   }
+  // Start from an empty directory so caches from an earlier run of the test
+  // cannot change its output.
   fs::path test_build_dir = build_dir / "tests" / test_dir.filename();
+  fs::remove_all(test_build_dir, ec);
   fs::create_directories(test_build_dir, ec);
   if (ec) {
     std::cerr << "Failed to create build dir: " << test_build_dir << "\n";
@@ -566,6 +1096,40 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  // expected_exit.txt holds errorck's exit status when it is not 0, for tests
+  // of runs that report failures.
+  int expected_exit = 0;
+  fs::path expected_exit_path = test_dir / "expected_exit.txt";
+  if (fs::exists(expected_exit_path, ec)) {
+    std::string text;
+    if (!ReadFile(expected_exit_path, text)) {
+      std::cerr << "Failed to read " << expected_exit_path << "\n";
+      return 1;
+    }
+    expected_exit = std::atoi(Trim(text).c_str());
+  }
+
+  // With a spool, errorck reads the sources from it instead.
+  bool has_spool = fs::is_directory(test_dir / "spool", ec);
+  if (has_spool && !CopySpool(test_dir, test_build_dir)) {
+    std::cerr << "Failed to copy the spool for " << test_dir << "\n";
+    return 1;
+  }
+  if (fs::exists(test_dir / "cc_commands.txt", ec)) {
+    if (!RunCompilerWrapper(build_dir / "errorck-cc", test_dir,
+                            test_build_dir)) {
+      return 1;
+    }
+    has_spool = true;
+  }
+
+  std::vector<std::string> ast_args;
+  bool has_ast_files = fs::exists(test_dir / "ast_files.txt", ec);
+  if (has_ast_files && !EmitAsts(clang_path, test_dir, test_build_dir, flags,
+                                 ast_args)) {
+    return 1;
+  }
+
   fs::path db_path = test_build_dir / "results.sqlite";
   std::vector<std::string> command = {
     errorck_path.string(),   "--db", db_path.string(),
@@ -574,54 +1138,86 @@ int main(int argc, char **argv) {
     command.push_back("--notable-functions");
     command.push_back(notable_path.string());
   }
-  for (const auto &arg : extra_args) {
-    command.push_back(arg);
-  }
-  for (const auto &source : sources) {
-    command.push_back(source.string());
-  }
-  CommandResult result = RunCommand(command);
-  if (result.exit_code != 0) {
-    std::cerr << "errorck failed for " << test_dir << " (exit "
-              << result.exit_code << ")\n";
-    if (!result.stdout_output.empty()) {
-      std::cerr << result.stdout_output;
+  AppendArgs(extra_args, test_build_dir, command);
+  command.insert(command.end(), ast_args.begin(), ast_args.end());
+  if (fs::exists(test_dir / "plugin_sources.txt", ec)) {
+    // CTest reports this exit status as a skipped test.
+    if (plugin_path.empty()) {
+      std::cout << "SKIP " << test_dir.filename().string()
+                << ": errorck-plugin is not built\n";
+      return 77;
     }
-    if (!result.stderr_output.empty()) {
-      std::cerr << result.stderr_output;
+    if (!RunPlugin(clang_path, plugin_path, build_dir / "errorck-merge",
+                   test_dir, test_build_dir, flags, notable_path, db_path) ||
+        !CompareDatabaseOutput(test_dir, db_path, expected_path,
+                               test_build_dir / "actual.jsonl")) {
+      return 1;
     }
-    return 1;
+    std::cout << "PASS " << test_dir.filename().string() << "\n";
+    return 0;
   }
-
-  std::string db_output;
-  std::string db_error;
-  if (!ReadDatabaseOutput(db_path, db_output, db_error)) {
-    std::cerr << "Failed to read database output for " << test_dir << "\n";
-    if (!db_error.empty()) {
-      std::cerr << db_error << "\n";
+  if (fs::exists(test_dir / "merge_inputs.txt", ec)) {
+    fs::path merge_path = build_dir / "errorck-merge";
+    if (!RunMerged(command, test_dir, test_build_dir, merge_path, db_path) ||
+        !CompareDatabaseOutput(test_dir, db_path, expected_path,
+                               test_build_dir / "actual.jsonl")) {
+      return 1;
     }
-    return 1;
+    std::cout << "PASS " << test_dir.filename().string() << "\n";
+    return 0;
   }
-
-  std::string normalized = NormalizeOutput(db_output, test_dir);
-  EnsureTrailingNewline(normalized);
-
-  std::string expected;
-  if (!ReadFile(expected_path, expected)) {
-    std::cerr << "Failed to read expected output for " << test_dir << "\n";
+  std::vector<std::string> first_command = command;
+  if (!has_spool && !has_ast_files) {
+    for (const auto &source : sources) {
+      first_command.push_back(source.string());
+    }
+  }
+  if (!RunAndCompare(first_command, test_dir, test_build_dir, db_path,
+                     expected_path, expected_exit)) {
     return 1;
   }
-  EnsureTrailingNewline(expected);
 
-  if (normalized != expected) {
-    fs::path actual_path = test_build_dir / "actual.jsonl";
-    if (!WriteFile(actual_path, normalized)) {
-      std::cerr << "Failed to write actual output for " << test_dir << "\n";
+  // rerun_args.txt runs errorck a second time over the same build directory,
+  // adding its arguments, and expects the same output. Tests of caches use it
+  // to check that replayed results match the ones first written.
+  fs::path rerun_args_path = test_dir / "rerun_args.txt";
+  if (fs::exists(rerun_args_path, ec)) {
+    std::vector<std::string> second_command = command;
+    AppendArgs(ReadErrorckArgs(rerun_args_path), test_build_dir,
+               second_command);
+    if (!has_spool && !has_ast_files) {
+      for (const auto &source : sources) {
+        second_command.push_back(source.string());
+      }
+    }
+    if (!RunAndCompare(second_command, test_dir, test_build_dir, db_path,
+                       expected_path, expected_exit)) {
       return 1;
     }
+  }
 
-    std::cerr << "FAIL " << test_dir.filename().string() << "\n";
-    PrintDiff(expected_path, actual_path);
+  // reject_args.txt holds one set of extra arguments per line. errorck must
+  // refuse each of them with exit status 1.
+  fs::path reject_args_path = test_dir / "reject_args.txt";
+  if (fs::exists(reject_args_path, ec)) {
+    for (const std::string &line : ReadErrorckArgs(reject_args_path)) {
+      std::vector<std::string> args;
+      std::istringstream words(line);
+      std::string word;
+      while (words >> word) {
+        args.push_back(word);
+      }
+      std::vector<std::string> reject_command = command;
+      AppendArgs(args, test_build_dir, reject_command);
+      if (!RunSucceeded(reject_command, test_dir, 1)) {
+        return 1;
+      }
+    }
+  }
+
+  fs::path expected_files_path = test_dir / "expected_files.txt";
+  if (fs::exists(expected_files_path, ec) &&
+      !CheckExpectedFiles(test_dir, test_build_dir, expected_files_path)) {
     return 1;
   }
 